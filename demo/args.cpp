@@ -5,19 +5,35 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <thread>
 
 
 namespace args {
 
 
 const char* inFile = "";
+bool atlas;
+int benchRuns;
+GeomType benchGeomType = GeomType::int32;
+const char* binaryRectsOutFile = "";
+int extrude;
+bool fixedSize;
 ImageFormat imageFormat = ImageFormat::png;
 const char* imagePrefix = "page_";
+int jobs = 0;
+const char* manifestFile = "";
+manifest::Format manifestFormat = manifest::Format::bin;
 int maxPageSize[2] = {INT_MAX, INT_MAX};
 int maxPages = 9999;
 const char* outDir = "";
 int padding[4];
+PageSelection pageSelection = PageSelection::firstFit;
+int numLastPages = 1;
+int reorder;
+int reorderDelay;
 int spacing[2];
+bool stream;
+const char* traceFile = "";
 
 
 const char* help = (
@@ -27,18 +43,66 @@ const char* help = (
 "\n"
 "  input-file            File to read rectangles from, or \"-\" for stdin\n"
 "\n"
+"  -atlas                Build a texture atlas from PNG images. input-file\n"
+"                        is either a directory or a file with one PNG\n"
+"                        path per line\n"
+"  -bench RUNS           Load, sort, and pack the input RUNS times, print\n"
+"                        timings of every phase, and exit without writing\n"
+"                        images\n"
+"  -bench-geom TYPE      GeomT for -bench: \"int\" (default), \"int64\",\n"
+"                        \"float\", or \"double\"\n"
+"  -extrude COUNT        Repeat edge pixels of atlas images COUNT times\n"
+"                        around them. Default is 0\n"
+"  -fixed-size           Give all pages the maximum size instead of growing\n"
+"                        them as needed. Needs -max-size\n"
 "  -help                 Print this help and exit\n"
-"  -image-format FORMAT  Output format of the image: \"png\" (default) or \"svg\"\n"
+"  -image-format FORMAT  Output format of the image: \"png\" (default), \"svg\",\n"
+"                        \"svgz\" (compressed SVG), or \"none\" to skip\n"
+"                        rendering\n"
 "  -image-prefix PREFIX  Prefix for image names. Default is \"%s\"\n"
+"  -jobs COUNT           Number of threads used to search for pages when\n"
+"                        packing and number of pages to render in\n"
+"                        parallel. Default is the number of CPU cores\n"
+"  -manifest FILE        Write placements of rectangles to FILE\n"
+"  -manifest-format FORMAT\n"
+"                        Format of the manifest: \"bin\" (default), \"csv\",\n"
+"                        or \"json\". See manifest.h for details\n"
 "  -max-size SIZE        Maximum size of one page. Default is %i:%i\n"
 "  -max-pages COUNT      Maximum number of pages. Default is %i\n"
 "  -out-dir PATH         Output directory. Default is \".\"\n"
 "  -padding PADDING      Page padding. Default is 0\n"
+"  -page-selection POLICY\n"
+"                        How to choose a page for a rectangle: \"first\"\n"
+"                        (default) for the first page that fits,\n"
+"                        \"last[:N]\" for the first that fits among the\n"
+"                        last N pages (1 by default), or \"best\" for the\n"
+"                        page with the least waste\n"
+"  -reorder COUNT        With -stream, buffer up to COUNT rectangles and\n"
+"                        pack them sorted. Placements are printed when\n"
+"                        the buffer is flushed, followed by the index of\n"
+"                        the rectangle in the input\n"
+"  -reorder-delay US     With -reorder, also flush the buffer when its\n"
+"                        oldest rectangle has waited US microseconds,\n"
+"                        even while no input arrives (except on Windows)\n"
 "  -spacing SPACING      Spacing between rectangles. Default is 0\n"
+"  -stream               Pack rectangles as they are read and print their\n"
+"                        placements line by line instead of writing images\n"
+"  -to-binary FILE       Convert the input to a binary rectangle list, write\n"
+"                        it to FILE, and exit\n"
+"  -trace FILE           Write a timeline of loading, packing, and rendering\n"
+"                        to FILE in the Trace Event format, viewable in\n"
+"                        chrome://tracing or Perfetto\n"
 "\n"
 "Input data format\n"
 "  The contents of the input file should be whitespace-separated descriptions\n"
-"  of rectangles in format WIDTHxHEIGHT.\n"
+"  of rectangles in format WIDTHxHEIGHT[xCOUNT], or a binary rectangle list\n"
+"  (see binary_rects.h), which is detected automatically.\n"
+"\n"
+"Streaming output format\n"
+"  With -stream, every inserted rectangle is reported as \"rect PAGE X Y\".\n"
+"  If the insertion created a page or changed its size, \"page PAGE WIDTH\n"
+"  HEIGHT\" is printed before that. Errors are reported as \"error TEXT\".\n"
+"  Output is flushed after every input line.\n"
 "\n"
 "Formats of arguments\n"
 "  The parameters that specify geometry allow to set either all values\n"
@@ -82,18 +146,82 @@ void parse(int argc, char* argv[])
     argc -= 1;
 
     int missingArgument = 0;
+    bool maxSizeGiven = false;
     for (int i = 1; i < argc; ++i) {
-        if (std::strcmp(argv[i], "-image-format") == 0) {
+        if (std::strcmp(argv[i], "-atlas") == 0)
+            atlas = true;
+        else if (std::strcmp(argv[i], "-bench") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            char* end;
+            benchRuns = std::strtol(argv[i], &end, 10);
+            if (argv[i] == end) {
+                std::fprintf(stderr, "Invalid %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
+
+            if (benchRuns <= 0)  {
+                std::fprintf(stderr, "%s must be > 0\n", argv[i - 1]);
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (std::strcmp(argv[i], "-bench-geom") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            if (std::strcmp(argv[i], "int") == 0)
+                benchGeomType = GeomType::int32;
+            else if (std::strcmp(argv[i], "int64") == 0)
+                benchGeomType = GeomType::int64;
+            else if (std::strcmp(argv[i], "float") == 0)
+                benchGeomType = GeomType::float32;
+            else if (std::strcmp(argv[i], "double") == 0)
+                benchGeomType = GeomType::float64;
+            else {
+                std::fprintf(stderr, "Unknown %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (std::strcmp(argv[i], "-extrude") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            char* end;
+            extrude = std::strtol(argv[i], &end, 10);
+            if (argv[i] == end) {
+                std::fprintf(stderr, "Invalid %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
+
+            if (extrude < 0)  {
+                std::fprintf(stderr, "%s must be >= 0\n", argv[i - 1]);
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (std::strcmp(argv[i], "-fixed-size") == 0)
+            fixedSize = true;
+        else if (std::strcmp(argv[i], "-image-format") == 0) {
             ++i;
             if (i == argc) {
                 missingArgument = i - 1;
                 break;
             }
 
-            if (std::strcmp(argv[i], "png") == 0)
+            if (std::strcmp(argv[i], "none") == 0)
+                imageFormat = ImageFormat::none;
+            else if (std::strcmp(argv[i], "png") == 0)
                 imageFormat = ImageFormat::png;
             else if (std::strcmp(argv[i], "svg") == 0)
                 imageFormat = ImageFormat::svg;
+            else if (std::strcmp(argv[i], "svgz") == 0)
+                imageFormat = ImageFormat::svgz;
             else {
                 std::fprintf(stderr, "Unknown %s: %s\n", argv[i - 1], argv[i]);
                 std::exit(EXIT_FAILURE);
@@ -106,6 +234,49 @@ void parse(int argc, char* argv[])
             }
 
             imagePrefix = argv[i];
+        } else if (std::strcmp(argv[i], "-jobs") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            char* end;
+            jobs = std::strtol(argv[i], &end, 10);
+            if (argv[i] == end) {
+                std::fprintf(stderr, "Invalid %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
+
+            if (jobs <= 0)  {
+                std::fprintf(stderr, "%s must be > 0\n", argv[i - 1]);
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (std::strcmp(argv[i], "-manifest") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            manifestFile = argv[i];
+        } else if (std::strcmp(argv[i], "-manifest-format") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            if (std::strcmp(argv[i], "bin") == 0)
+                manifestFormat = manifest::Format::bin;
+            else if (std::strcmp(argv[i], "csv") == 0)
+                manifestFormat = manifest::Format::csv;
+            else if (std::strcmp(argv[i], "json") == 0)
+                manifestFormat = manifest::Format::json;
+            else {
+                std::fprintf(stderr, "Unknown %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
         } else if (std::strcmp(argv[i], "-max-size") == 0) {
             ++i;
             if (i == argc) {
@@ -122,6 +293,8 @@ void parse(int argc, char* argv[])
 
             if (numRead == 1)
                 maxPageSize[1] = maxPageSize[0];
+
+            maxSizeGiven = true;
         } else if (std::strcmp(argv[i], "-max-pages") == 0) {
             ++i;
             if (i == argc) {
@@ -166,6 +339,50 @@ void parse(int argc, char* argv[])
             if (numRead == 1)
                 for (int i = 1; i < 4; ++i)
                     padding[i] = padding[0];
+        } else if (std::strcmp(argv[i], "-page-selection") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            if (std::strcmp(argv[i], "first") == 0)
+                pageSelection = PageSelection::firstFit;
+            else if (std::strcmp(argv[i], "best") == 0)
+                pageSelection = PageSelection::bestFit;
+            else if (std::strcmp(argv[i], "last") == 0)
+                pageSelection = PageSelection::lastPages;
+            else if (std::sscanf(argv[i], "last:%d", &numLastPages) == 1
+                    && numLastPages > 0)
+                pageSelection = PageSelection::lastPages;
+            else {
+                std::fprintf(stderr, "Invalid %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (std::strcmp(argv[i], "-reorder") == 0
+                || std::strcmp(argv[i], "-reorder-delay") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+
+            char* end;
+            const int value = std::strtol(argv[i], &end, 10);
+            if (argv[i] == end) {
+                std::fprintf(stderr, "Invalid %s: %s\n", argv[i - 1], argv[i]);
+                std::exit(EXIT_FAILURE);
+            }
+
+            if (value <= 0)  {
+                std::fprintf(stderr, "%s must be > 0\n", argv[i - 1]);
+                std::exit(EXIT_FAILURE);
+            }
+
+            if (std::strcmp(argv[i - 1], "-reorder") == 0)
+                reorder = value;
+            else
+                reorderDelay = value;
         } else if (std::strcmp(argv[i], "-spacing") == 0) {
             ++i;
             if (i == argc) {
@@ -182,6 +399,22 @@ void parse(int argc, char* argv[])
 
             if (numRead == 1)
                 spacing[1] = spacing[0];
+        } else if (std::strcmp(argv[i], "-stream") == 0)
+            stream = true;
+        else if (std::strcmp(argv[i], "-to-binary") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+            binaryRectsOutFile = argv[i];
+        } else if (std::strcmp(argv[i], "-trace") == 0) {
+            ++i;
+            if (i == argc) {
+                missingArgument = i - 1;
+                break;
+            }
+            traceFile = argv[i];
         } else {
             std::fprintf(stderr, "Unknown option %s\n", argv[i]);
             std::exit(EXIT_FAILURE);
@@ -193,6 +426,31 @@ void parse(int argc, char* argv[])
             stderr, "%s expects an argument\n", argv[missingArgument]);
         std::exit(EXIT_FAILURE);
     }
+
+    if (benchRuns > 0 && (atlas || std::strcmp(inFile, "-") == 0)) {
+        std::fprintf(stderr, "-bench needs a rectangle file\n");
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The default maximum size is unlimited, and so would be every
+    // fixed-size page.
+    if (fixedSize && !maxSizeGiven) {
+        std::fprintf(stderr, "-fixed-size needs -max-size\n");
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (atlas
+            && imageFormat != ImageFormat::png
+            && imageFormat != ImageFormat::none) {
+        std::fprintf(stderr, "-atlas only supports png image format\n");
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (jobs == 0) {
+        jobs = std::thread::hardware_concurrency();
+        if (jobs == 0)
+            jobs = 1;
+    }
 }
 
 
@@ -1,24 +1,58 @@
 
 #pragma once
 
+#include "manifest.h"
+
 
 namespace args {
 
 
 enum class ImageFormat {
+    none,
     png,
     svg,
+    svgz,
+};
+
+
+enum class PageSelection {
+    firstFit,
+    lastPages,
+    bestFit,
+};
+
+
+enum class GeomType {
+    int32,
+    int64,
+    float32,
+    float64,
 };
 
 
 extern const char* inFile;
+extern bool atlas;
+extern int benchRuns;
+extern GeomType benchGeomType;
+extern const char* binaryRectsOutFile;
+extern int extrude;
+extern bool fixedSize;
 extern ImageFormat imageFormat;
 extern const char* imagePrefix;
+extern int jobs;
+extern const char* manifestFile;
+extern manifest::Format manifestFormat;
 extern int maxPageSize[2];
 extern int maxPages;
 extern const char* outDir;
 extern int padding[4];
+extern PageSelection pageSelection;
+extern int numLastPages;
+extern int reorder;
+extern int reorderDelay;
 extern int spacing[2];
+extern bool stream;
+extern const char* traceFile;
 
 
 void parse(int argc, char* argv[]);
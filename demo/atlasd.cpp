@@ -0,0 +1,436 @@
+// atlasd: a daemon that serves named atlases over a Unix domain
+// socket. See atlasd_protocol.h for the protocol.
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "atlasd_protocol.h"
+#include "dp_rect_pack.h"
+
+
+using namespace atlasd;
+using Packer = dp::rect_pack::RectPacker<std::int32_t>;
+
+
+struct Atlas {
+    // Name, geometry, and w and h of every successfully inserted rect.
+    Snapshot state;
+    Packer packer;
+
+    Atlas(const std::string& name, const std::int32_t* geometry)
+        : state()
+        , packer(
+            geometry[0], geometry[1],
+            Packer::Spacing(geometry[2], geometry[3]),
+            Packer::Padding(
+                geometry[4], geometry[5], geometry[6], geometry[7]))
+    {
+        state.name = name;
+        std::memcpy(state.geometry, geometry, sizeof(state.geometry));
+    }
+};
+
+
+std::vector<std::unique_ptr<Atlas>> atlases;
+std::map<std::string, std::uint32_t> atlasIds;
+
+// Directory for snapshot requests; empty if they are disabled.
+std::string snapshotDir;
+
+
+static std::uint32_t getAtlas(
+    const std::string& name, const std::int32_t* geometry)
+{
+    const auto iter = atlasIds.find(name);
+    if (iter != atlasIds.end())
+        return iter->second;
+
+    const auto id = static_cast<std::uint32_t>(atlases.size());
+    atlases.emplace_back(new Atlas(name, geometry));
+    atlasIds[name] = id;
+    return id;
+}
+
+
+static bool saveSnapshot(const Atlas& atlas, const std::string& path)
+{
+    std::vector<std::uint8_t> data;
+    encodeSnapshot(atlas.state, data);
+
+    // Write to a temporary file first so that a failure doesn't
+    // destroy the previous snapshot.
+    const auto tmpPath = path + ".tmp";
+    std::FILE* fp = std::fopen(tmpPath.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    const bool written = (
+        std::fwrite(data.data(), 1, data.size(), fp) == data.size());
+    if (std::fclose(fp) != 0 || !written
+            || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+static void loadSnapshot(const char* path)
+{
+    std::FILE* fp = std::fopen(path, "rb");
+    if (!fp) {
+        std::fprintf(
+            stderr,
+            "Can't open %s for reading: %s\n", path, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::uint8_t> data;
+    std::uint8_t buf[1 << 16];
+    std::size_t numRead;
+    while ((numRead = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + numRead);
+    std::fclose(fp);
+
+    Snapshot snapshot;
+    const auto* error = decodeSnapshot(data.data(), data.size(), snapshot);
+    if (error) {
+        std::fprintf(stderr, "%s: %s\n", path, error);
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (atlasIds.count(snapshot.name) != 0) {
+        std::fprintf(
+            stderr, "%s: atlas \"%s\" is already loaded\n",
+            path, snapshot.name.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto& atlas = *atlases[getAtlas(snapshot.name, snapshot.geometry)];
+    for (std::size_t i = 0; i < snapshot.sizes.size(); i += 2)
+        atlas.packer.insert(snapshot.sizes[i], snapshot.sizes[i + 1]);
+    atlas.state.sizes.swap(snapshot.sizes);
+}
+
+
+// Handle a request and append the response payload to out. If the
+// status is not ok, nothing is appended and the state is unchanged.
+static Status handleRequest(
+    const std::uint8_t* data,
+    std::size_t size,
+    std::vector<std::uint8_t>& out)
+{
+    Request request;
+    if (!decodeRequest(data, size, request))
+        return Status::badRequest;
+
+    if (request.opcode != Opcode::open && request.atlasId >= atlases.size())
+        return Status::unknownAtlas;
+
+    Writer writer(out);
+
+    switch (request.opcode) {
+        case Opcode::open:
+            writer.writeU8(static_cast<std::uint8_t>(Status::ok));
+            writer.writeU32(getAtlas(request.name, request.geometry));
+            break;
+        case Opcode::alloc: {
+            auto& atlas = *atlases[request.atlasId];
+            const auto& sizes = request.sizes;
+            const std::size_t count = sizes.size() / 2;
+
+            writer.writeU8(static_cast<std::uint8_t>(Status::ok));
+            writer.writeU32(count);
+            out.reserve(out.size() + count * 13);
+
+            for (std::size_t i = 0; i < sizes.size(); i += 2) {
+                const auto w = sizes[i];
+                const auto h = sizes[i + 1];
+
+                const auto result = atlas.packer.insert(w, h);
+                writer.writeU8(result.status);
+                if (result.status == dp::rect_pack::InsertStatus::ok) {
+                    writer.writeU32(result.pageIndex);
+                    writer.writeI32(result.pos.x);
+                    writer.writeI32(result.pos.y);
+
+                    atlas.state.sizes.push_back(w);
+                    atlas.state.sizes.push_back(h);
+                } else {
+                    writer.writeU32(0);
+                    writer.writeI32(0);
+                    writer.writeI32(0);
+                }
+            }
+            break;
+        }
+        case Opcode::pageSize: {
+            const auto& packer = atlases[request.atlasId]->packer;
+            if (request.pageIdx >= packer.getNumPages())
+                return Status::badPageIndex;
+
+            std::int32_t w, h;
+            packer.getPageSize(request.pageIdx, w, h);
+
+            writer.writeU8(static_cast<std::uint8_t>(Status::ok));
+            writer.writeU32(packer.getNumPages());
+            writer.writeI32(w);
+            writer.writeI32(h);
+            break;
+        }
+        case Opcode::snapshot:
+            if (snapshotDir.empty())
+                return Status::snapshotsDisabled;
+            if (!isValidSnapshotName(request.snapshotName))
+                return Status::badRequest;
+
+            if (!saveSnapshot(
+                    *atlases[request.atlasId],
+                    snapshotDir + '/' + request.snapshotName))
+                return Status::ioError;
+
+            writer.writeU8(static_cast<std::uint8_t>(Status::ok));
+            break;
+    }
+
+    return Status::ok;
+}
+
+
+struct Client {
+    int fd;
+    std::vector<std::uint8_t> in;
+    std::vector<std::uint8_t> out;
+    // Number of bytes of out that were already sent.
+    std::size_t outPos;
+
+    explicit Client(int fd)
+        : fd(fd)
+        , in()
+        , out()
+        , outPos(0)
+    {}
+};
+
+
+// Process all complete messages in client.in. Returns false if the
+// client sent a message that is too big.
+static bool processMessages(Client& client)
+{
+    std::size_t pos = 0;
+    while (client.in.size() - pos >= 4) {
+        const auto size = Reader(&client.in[pos], 4).readU32();
+        if (size > maxMessageSize)
+            return false;
+        if (client.in.size() - pos - 4 < size)
+            break;
+
+        const auto sizePos = client.out.size();
+        client.out.resize(sizePos + 4);
+
+        const auto status = handleRequest(
+            client.in.data() + pos + 4, size, client.out);
+        if (status != Status::ok)
+            client.out.push_back(static_cast<std::uint8_t>(status));
+
+        const std::uint32_t responseSize = client.out.size() - sizePos - 4;
+        for (int i = 0; i < 4; ++i)
+            client.out[sizePos + i] = (responseSize >> (i * 8)) & 0xff;
+
+        pos += 4 + size;
+    }
+
+    client.in.erase(client.in.begin(), client.in.begin() + pos);
+    return true;
+}
+
+
+// Returns false if the connection should be closed.
+static bool readClient(Client& client)
+{
+    std::uint8_t buf[1 << 16];
+    while (true) {
+        const auto n = read(client.fd, buf, sizeof(buf));
+        if (n > 0)
+            client.in.insert(client.in.end(), buf, buf + n);
+        else if (n == 0)
+            return false;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else if (errno != EINTR)
+            return false;
+    }
+
+    return processMessages(client);
+}
+
+
+// Returns false if the connection should be closed.
+static bool writeClient(Client& client)
+{
+    while (client.outPos < client.out.size()) {
+        const auto n = write(
+            client.fd,
+            &client.out[client.outPos],
+            client.out.size() - client.outPos);
+        if (n >= 0)
+            client.outPos += n;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        else if (errno != EINTR)
+            return false;
+    }
+
+    client.out.clear();
+    client.outPos = 0;
+    return true;
+}
+
+
+static void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+static int listenOn(const char* path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(addr.sun_path)) {
+        std::fprintf(stderr, "Socket path is too long: %s\n", path);
+        std::exit(EXIT_FAILURE);
+    }
+    std::strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::fprintf(
+            stderr, "Can't create socket: %s\n", std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    unlink(path);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(fd, SOMAXCONN) != 0) {
+        std::fprintf(
+            stderr, "Can't listen on %s: %s\n", path, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    setNonBlocking(fd);
+    return fd;
+}
+
+
+static void serve(int listenFd)
+{
+    std::vector<std::unique_ptr<Client>> clients;
+    std::vector<pollfd> pollFds;
+
+    while (true) {
+        pollFds.clear();
+        pollFds.push_back({listenFd, POLLIN, 0});
+        for (const auto& client : clients) {
+            short events = POLLIN;
+            if (client->outPos < client->out.size())
+                events |= POLLOUT;
+            pollFds.push_back({client->fd, events, 0});
+        }
+
+        if (poll(pollFds.data(), pollFds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            std::fprintf(stderr, "poll() failed: %s\n", std::strerror(errno));
+            std::exit(EXIT_FAILURE);
+        }
+
+        // Go backwards so that closed clients can be removed in place.
+        for (std::size_t i = clients.size(); i-- > 0;) {
+            auto& client = *clients[i];
+            const auto revents = pollFds[i + 1].revents;
+
+            bool keep = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+                keep = readClient(client);
+            // Try to send the responses right away instead of waiting
+            // for the next poll().
+            if (keep)
+                keep = writeClient(client);
+
+            if (!keep) {
+                close(client.fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+
+        if (pollFds[0].revents & POLLIN)
+            while (true) {
+                const int fd = accept(listenFd, nullptr, nullptr);
+                if (fd < 0)
+                    break;
+
+                setNonBlocking(fd);
+                clients.emplace_back(new Client(fd));
+            }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    int argIdx = 1;
+    if (argc - argIdx >= 2
+            && std::strcmp(argv[argIdx], "-snapshot-dir") == 0) {
+        snapshotDir = argv[argIdx + 1];
+        argIdx += 2;
+    }
+
+    if (argIdx >= argc || std::strcmp(argv[argIdx], "-help") == 0) {
+        std::printf(
+            "atlasd: atlas allocation daemon\n"
+            "\n"
+            "Usage: %s [-snapshot-dir DIR] socket-path [snapshot...]\n"
+            "\n"
+            "  -snapshot-dir DIR  Directory where snapshot requests save\n"
+            "                     atlases; without it, clients can't\n"
+            "                     save snapshots\n"
+            "  socket-path        Unix domain socket to listen on\n"
+            "  snapshot           Atlas snapshot to restore at startup\n"
+            "\n"
+            "See atlasd_protocol.h for the protocol.\n",
+            argv[0]);
+        return argIdx >= argc ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (snapshotDir.empty() && argIdx > 1) {
+        std::fprintf(stderr, "Snapshot directory is empty\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* socketPath = argv[argIdx];
+    for (int i = argIdx + 1; i < argc; ++i)
+        loadSnapshot(argv[i]);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    serve(listenOn(socketPath));
+}
@@ -0,0 +1,139 @@
+#include "atlasd_protocol.h"
+
+#include <cstring>
+
+
+namespace atlasd {
+
+
+bool decodeRequest(
+    const std::uint8_t* data, std::size_t size, Request& request)
+{
+    Reader reader(data, size);
+
+    request.opcode = static_cast<Opcode>(reader.readU8());
+    switch (request.opcode) {
+        case Opcode::open:
+            request.name = reader.readString();
+            for (auto& v : request.geometry)
+                v = reader.readI32();
+            break;
+        case Opcode::alloc: {
+            request.atlasId = reader.readU32();
+            const auto count = reader.readU32();
+            // Check the count against the payload before allocating
+            // anything for it.
+            if (!reader.isOk()
+                    || reader.getNumRemaining() / 8 != count
+                    || reader.getNumRemaining() % 8 != 0)
+                return false;
+
+            request.sizes.resize(static_cast<std::size_t>(count) * 2);
+            for (auto& v : request.sizes)
+                v = reader.readI32();
+            break;
+        }
+        case Opcode::pageSize:
+            request.atlasId = reader.readU32();
+            request.pageIdx = reader.readU32();
+            break;
+        case Opcode::snapshot:
+            request.atlasId = reader.readU32();
+            request.snapshotName = reader.readString();
+            break;
+        default:
+            return false;
+    }
+
+    return reader.isOk() && reader.isAtEnd();
+}
+
+
+void encodeRequest(const Request& request, std::vector<std::uint8_t>& out)
+{
+    Writer writer(out);
+
+    writer.writeU8(static_cast<std::uint8_t>(request.opcode));
+    switch (request.opcode) {
+        case Opcode::open:
+            writer.writeString(request.name);
+            for (const auto v : request.geometry)
+                writer.writeI32(v);
+            break;
+        case Opcode::alloc:
+            writer.writeU32(request.atlasId);
+            writer.writeU32(request.sizes.size() / 2);
+            for (const auto v : request.sizes)
+                writer.writeI32(v);
+            break;
+        case Opcode::pageSize:
+            writer.writeU32(request.atlasId);
+            writer.writeU32(request.pageIdx);
+            break;
+        case Opcode::snapshot:
+            writer.writeU32(request.atlasId);
+            writer.writeString(request.snapshotName);
+            break;
+    }
+}
+
+
+bool isValidSnapshotName(const std::string& name)
+{
+    return (
+        !name.empty()
+        && name[0] != '.'
+        && name.find_first_of(std::string("/\\\0", 3)) == name.npos);
+}
+
+
+void encodeSnapshot(const Snapshot& snapshot, std::vector<std::uint8_t>& out)
+{
+    out.insert(
+        out.end(), snapshotMagic, snapshotMagic + sizeof(snapshotMagic));
+
+    Writer writer(out);
+    writer.writeU8(snapshotVersion);
+    writer.writeU(0, 3);
+    writer.writeString(snapshot.name);
+    for (const auto v : snapshot.geometry)
+        writer.writeI32(v);
+    writer.writeU32(snapshot.sizes.size() / 2);
+    for (const auto v : snapshot.sizes)
+        writer.writeI32(v);
+}
+
+
+const char* decodeSnapshot(
+    const std::uint8_t* data, std::size_t size, Snapshot& snapshot)
+{
+    if (size < sizeof(snapshotMagic)
+            || std::memcmp(data, snapshotMagic, sizeof(snapshotMagic)) != 0)
+        return "not an atlas snapshot";
+
+    Reader reader(data + sizeof(snapshotMagic), size - sizeof(snapshotMagic));
+    const auto version = reader.readU8();
+    reader.readU(3);
+    snapshot.name = reader.readString();
+    for (auto& v : snapshot.geometry)
+        v = reader.readI32();
+    const auto count = reader.readU32();
+
+    if (!reader.isOk() || version != snapshotVersion)
+        return "invalid or unsupported snapshot";
+
+    if (reader.getNumRemaining() / 8 < count)
+        return "truncated snapshot";
+    if (reader.getNumRemaining() / 8 != count
+            || reader.getNumRemaining() % 8 != 0)
+        return "trailing data in snapshot";
+
+    snapshot.sizes.resize(static_cast<std::size_t>(count) * 2);
+    for (auto& v : snapshot.sizes)
+        v = reader.readI32();
+
+    return nullptr;
+}
+
+
+}
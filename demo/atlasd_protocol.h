@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Protocol of atlasd, the atlas allocation daemon.
+//
+// Clients connect to a Unix domain stream socket and exchange
+// messages. Every message is a little-endian uint32 payload size
+// followed by the payload. All integers are little-endian; i32 are
+// signed and u8/u16/u32 are unsigned.
+//
+// A request payload starts with a u8 opcode; a response payload
+// starts with a u8 status (see Status). If the status is not ok,
+// the response has no other fields. Requests from a single client
+// are answered in order, so clients may pipeline them.
+//
+// open: get an atlas by name, creating it on first use
+//   Request:  u16 name size, name, i32 max page width, i32 max page
+//             height, i32 spacing x, i32 spacing y, i32 padding top,
+//             i32 padding bottom, i32 padding left, i32 padding right
+//   Response: u32 atlas id
+//   Geometry is ignored if the atlas already exists.
+//
+// alloc: insert a batch of rectangles
+//   Request:  u32 atlas id, u32 count, count * (i32 w, i32 h)
+//   Response: u32 count, count * (u8 InsertStatus, u32 page index,
+//             i32 x, i32 y)
+//   Rectangles are inserted in the given order, so clients should
+//   sort them as described in RectPacker::insert().
+//
+// pageSize: query the number of pages and the size of a page
+//   Request:  u32 atlas id, u32 page index
+//   Response: u32 number of pages, i32 page width, i32 page height
+//
+// snapshot: save an atlas to a file in the daemon's snapshot
+// directory
+//   Request:  u32 atlas id, u16 name size, name
+//   Response: no fields
+//   The name is a file name in the directory given to atlasd with
+//   -snapshot-dir; see isValidSnapshotName(). If atlasd was started
+//   without -snapshot-dir, the status is snapshotsDisabled.
+//
+// Snapshots can be passed to atlasd at startup to restore atlases.
+// A snapshot holds the name and geometry of the atlas and the list
+// of successfully inserted rectangles, which are inserted again on
+// restore; RectPacker is deterministic, so that results in the same
+// layout.
+namespace atlasd {
+
+
+const std::uint32_t maxMessageSize = 64 * 1024 * 1024;
+
+// Number of i32 geometry values in the open request.
+const int numGeometryValues = 8;
+
+
+enum class Opcode : std::uint8_t {
+    open = 1,
+    alloc = 2,
+    pageSize = 3,
+    snapshot = 4,
+};
+
+
+enum class Status : std::uint8_t {
+    ok = 0,
+    badRequest = 1,
+    unknownAtlas = 2,
+    badPageIndex = 3,
+    ioError = 4,
+    snapshotsDisabled = 5,
+};
+
+
+// Snapshot file:
+//   4 bytes magic "DPAS", u8 version (1), 3 reserved bytes (0),
+//   u16 name size, name, 8 * i32 geometry in the order of the open
+//   request, u32 count, count * (i32 w, i32 h)
+const char snapshotMagic[4] = {'D', 'P', 'A', 'S'};
+const int snapshotVersion = 1;
+
+
+class Reader {
+public:
+    Reader(const std::uint8_t* data, std::size_t size)
+        : p(data)
+        , end(data + size)
+        , ok(true)
+    {}
+
+    bool isOk() const
+    {
+        return ok;
+    }
+
+    bool isAtEnd() const
+    {
+        return p == end;
+    }
+
+    std::size_t getNumRemaining() const
+    {
+        return end - p;
+    }
+
+    std::uint32_t readU(int numBytes)
+    {
+        if (end - p < numBytes) {
+            ok = false;
+            p = end;
+            return 0;
+        }
+
+        std::uint32_t result = 0;
+        for (int i = 0; i < numBytes; ++i)
+            result |= static_cast<std::uint32_t>(*p++) << (i * 8);
+        return result;
+    }
+
+    std::uint8_t readU8()
+    {
+        return readU(1);
+    }
+
+    std::uint16_t readU16()
+    {
+        return readU(2);
+    }
+
+    std::uint32_t readU32()
+    {
+        return readU(4);
+    }
+
+    std::int32_t readI32()
+    {
+        return static_cast<std::int32_t>(readU(4));
+    }
+
+    std::string readString()
+    {
+        const std::size_t size = readU16();
+        if (static_cast<std::size_t>(end - p) < size) {
+            ok = false;
+            p = end;
+            return std::string();
+        }
+
+        std::string result(reinterpret_cast<const char*>(p), size);
+        p += size;
+        return result;
+    }
+private:
+    const std::uint8_t* p;
+    const std::uint8_t* end;
+    bool ok;
+};
+
+
+class Writer {
+public:
+    explicit Writer(std::vector<std::uint8_t>& buf)
+        : buf(buf)
+    {}
+
+    void writeU(std::uint32_t v, int numBytes)
+    {
+        for (int i = 0; i < numBytes; ++i)
+            buf.push_back((v >> (i * 8)) & 0xff);
+    }
+
+    void writeU8(std::uint8_t v)
+    {
+        writeU(v, 1);
+    }
+
+    void writeU16(std::uint16_t v)
+    {
+        writeU(v, 2);
+    }
+
+    void writeU32(std::uint32_t v)
+    {
+        writeU(v, 4);
+    }
+
+    void writeI32(std::int32_t v)
+    {
+        writeU(v, 4);
+    }
+
+    // The size must fit in u16.
+    void writeString(const std::string& str)
+    {
+        writeU16(str.size());
+        buf.insert(buf.end(), str.begin(), str.end());
+    }
+private:
+    std::vector<std::uint8_t>& buf;
+};
+
+
+// A decoded request. Only the fields used by the opcode are set.
+struct Request {
+    Opcode opcode;
+
+    // open
+    std::string name;
+    std::int32_t geometry[numGeometryValues];
+
+    // alloc, pageSize, snapshot
+    std::uint32_t atlasId;
+
+    // alloc: w and h of every rect
+    std::vector<std::int32_t> sizes;
+
+    // pageSize
+    std::uint32_t pageIdx;
+
+    // snapshot
+    std::string snapshotName;
+
+    Request()
+        : opcode()
+        , name()
+        , geometry()
+        , atlasId()
+        , sizes()
+        , pageIdx()
+        , snapshotName()
+    {}
+};
+
+
+// Decode a request payload. Returns false if the opcode is unknown or
+// the payload doesn't have exactly the size the opcode requires, so
+// a request is either fully valid or rejected before any of it is
+// acted on.
+bool decodeRequest(
+    const std::uint8_t* data, std::size_t size, Request& request);
+
+// Append the payload of the request to out.
+void encodeRequest(const Request& request, std::vector<std::uint8_t>& out);
+
+// Returns true if the name can be used as a snapshot file name: it
+// is not empty, doesn't start with a dot, and doesn't contain path
+// separators or null characters.
+bool isValidSnapshotName(const std::string& name);
+
+
+struct Snapshot {
+    std::string name;
+    std::int32_t geometry[numGeometryValues];
+    // w and h of every inserted rect.
+    std::vector<std::int32_t> sizes;
+
+    Snapshot()
+        : name()
+        , geometry()
+        , sizes()
+    {}
+};
+
+
+// Append the snapshot file data to out.
+void encodeSnapshot(const Snapshot& snapshot, std::vector<std::uint8_t>& out);
+
+// Decode snapshot file data. Returns nullptr on success, or an error
+// message.
+const char* decodeSnapshot(
+    const std::uint8_t* data, std::size_t size, Snapshot& snapshot);
+
+
+}
@@ -0,0 +1,298 @@
+#include "binary_rects.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace binary_rects {
+
+
+static std::uint32_t readU16(const std::uint8_t* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+
+static std::uint32_t readU32(const std::uint8_t* p)
+{
+    return (
+        static_cast<std::uint32_t>(p[0])
+        | static_cast<std::uint32_t>(p[1]) << 8
+        | static_cast<std::uint32_t>(p[2]) << 16
+        | static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+
+static void writeU16(std::uint8_t* p, std::uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+
+static void writeU32(std::uint8_t* p, std::uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+
+static bool hasMagic(const std::uint8_t* data, std::size_t size)
+{
+    return (
+        size >= sizeof(magic)
+        && std::memcmp(data, magic, sizeof(magic)) == 0);
+}
+
+
+static void fail(const char* name, const char* reason)
+{
+    std::fprintf(
+        stderr, "%s: invalid binary rectangle list: %s\n", name, reason);
+    std::exit(EXIT_FAILURE);
+}
+
+
+// The data should start with the magic.
+static void decode(
+    const std::uint8_t* data, std::size_t size,
+    const char* name, std::vector<Item>& items)
+{
+    assert(hasMagic(data, size));
+
+    if (size < headerSize)
+        fail(name, "truncated header");
+
+    if (data[4] != version)
+        fail(name, "unsupported version");
+
+    const int intSize = data[5];
+    if (intSize != 2 && intSize != 4)
+        fail(name, "integer size should be 2 or 4");
+
+    if (readU16(data + 6) != 0)
+        fail(name, "reserved field is not 0");
+
+    // The number of records comes from the file, so check it against
+    // the bytes that follow the header before using it.
+    const std::size_t numRecords = readU32(data + 8);
+    const std::size_t recordSize = intSize * 3;
+    const std::size_t recordsSize = size - headerSize;
+    if (numRecords > recordsSize / recordSize)
+        fail(name, "truncated records");
+    if (numRecords * recordSize != recordsSize)
+        fail(name, "size doesn't match the number of records");
+
+    const auto* records = data + headerSize;
+    const auto* recordsEnd = records + numRecords * recordSize;
+
+    // Reserve the exact number of items in advance so that the
+    // second pass fills the array without reallocations. Counts are
+    // not bounded by the file size, so a tiny corrupt file could ask
+    // for an arbitrary amount of memory; check the total against
+    // maxNumItems first.
+    std::size_t numItems = items.size();
+    for (const auto* p = records; p < recordsEnd; p += recordSize) {
+        const std::size_t count = (
+            intSize == 2 ? readU16(p + 4) : readU32(p + 8));
+        if (count > maxNumItems - numItems)
+            fail(name, "too many items");
+        numItems += count;
+    }
+    items.reserve(numItems);
+
+    for (const auto* p = records; p < recordsEnd; p += recordSize) {
+        int w, h;
+        std::size_t count;
+        if (intSize == 2) {
+            w = static_cast<std::int16_t>(readU16(p));
+            h = static_cast<std::int16_t>(readU16(p + 2));
+            count = readU16(p + 4);
+        } else {
+            w = static_cast<std::int32_t>(readU32(p));
+            h = static_cast<std::int32_t>(readU32(p + 4));
+            count = readU32(p + 8);
+        }
+
+        items.insert(items.end(), count, Item(w, h));
+    }
+}
+
+
+static void failRead(const char* name)
+{
+    std::fprintf(
+        stderr, "Can't read %s: %s\n", name, std::strerror(errno));
+    std::exit(EXIT_FAILURE);
+}
+
+
+#ifndef _WIN32
+
+
+bool load(const char* fileName, std::vector<Item>& items)
+{
+    const int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        failRead(fileName);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        failRead(fileName);
+
+    const auto size = static_cast<std::size_t>(st.st_size);
+    if (size < sizeof(magic)) {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        failRead(fileName);
+
+    const auto* data = static_cast<const std::uint8_t*>(mapping);
+    const bool isBinary = hasMagic(data, size);
+    if (isBinary) {
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        decode(data, size, fileName, items);
+    }
+
+    munmap(mapping, size);
+    return isBinary;
+}
+
+
+#else
+
+
+bool load(const char* fileName, std::vector<Item>& items)
+{
+    std::FILE* fp = std::fopen(fileName, "rb");
+    if (!fp)
+        failRead(fileName);
+
+    const bool isBinary = loadFp(fp, fileName, items);
+    std::fclose(fp);
+    return isBinary;
+}
+
+
+#endif
+
+
+bool loadFp(std::FILE* fp, const char* name, std::vector<Item>& items)
+{
+    const int c = std::getc(fp);
+    if (c == EOF)
+        return false;
+
+    if (c != static_cast<unsigned char>(magic[0])) {
+        std::ungetc(c, fp);
+        return false;
+    }
+
+    std::vector<std::uint8_t> data(1, c);
+    std::uint8_t buf[1 << 16];
+    std::size_t numRead;
+    while ((numRead = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + numRead);
+
+    if (std::ferror(fp))
+        failRead(name);
+
+    if (!hasMagic(data.data(), data.size()))
+        fail(name, "bad magic");
+
+    decode(data.data(), data.size(), name, items);
+    return true;
+}
+
+
+void save(const char* fileName, const std::vector<Item>& items)
+{
+    struct Record {
+        int w;
+        int h;
+        std::size_t count;
+    };
+
+    std::vector<Record> records;
+    for (const auto& item : items)
+        if (!records.empty()
+                && records.back().w == item.rect.w
+                && records.back().h == item.rect.h
+                && records.back().count < UINT32_MAX)
+            ++records.back().count;
+        else
+            records.push_back({item.rect.w, item.rect.h, 1});
+
+    bool fitsIn16 = true;
+    for (const auto& record : records)
+        if (record.w < INT16_MIN || record.w > INT16_MAX
+                || record.h < INT16_MIN || record.h > INT16_MAX
+                || record.count > UINT16_MAX) {
+            fitsIn16 = false;
+            break;
+        }
+
+    const std::size_t intSize = fitsIn16 ? 2 : 4;
+    const std::size_t recordSize = intSize * 3;
+
+    std::vector<std::uint8_t> data(headerSize + records.size() * recordSize);
+    std::memcpy(&data[0], magic, sizeof(magic));
+    data[4] = version;
+    data[5] = intSize;
+    writeU16(&data[6], 0);
+    writeU32(&data[8], records.size());
+
+    auto* p = &data[headerSize];
+    for (const auto& record : records) {
+        if (fitsIn16) {
+            writeU16(p, record.w);
+            writeU16(p + 2, record.h);
+            writeU16(p + 4, record.count);
+        } else {
+            writeU32(p, record.w);
+            writeU32(p + 4, record.h);
+            writeU32(p + 8, record.count);
+        }
+        p += recordSize;
+    }
+
+    std::FILE* fp = std::fopen(fileName, "wb");
+    if (!fp) {
+        std::fprintf(
+            stderr,
+            "Can't open %s for writing: %s\n",
+            fileName, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (std::fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+        std::fprintf(
+            stderr, "Can't write %s: %s\n", fileName, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (std::fclose(fp) != 0) {
+        std::fprintf(
+            stderr, "Can't write %s: %s\n", fileName, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+
+}
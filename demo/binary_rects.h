@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#include "item.h"
+
+
+// Binary rectangle list.
+//
+// This is a compact alternative to the text format for programs
+// that already have the sizes in memory. All integers are
+// little-endian.
+//
+//   Offset  Size  Description
+//   0       4     Magic: "DPRL"
+//   4       1     Format version (1)
+//   5       1     Size of integers in records: 2 or 4 bytes
+//   6       2     Reserved; must be 0
+//   8       4     Number of records
+//   12            Records
+//
+// Each record is three integers: width, height, and count. Width
+// and height are signed; count is unsigned. A record is expanded
+// to count items, just like WIDTHxHEIGHTxCOUNT in the text format.
+// The total number of items is limited to maxNumItems.
+namespace binary_rects {
+
+
+const char magic[4] = {'D', 'P', 'R', 'L'};
+const int version = 1;
+const int headerSize = 12;
+// Far more than can be packed in reasonable time, but small enough
+// that a corrupt count can't exhaust memory (4 GiB of items).
+const std::size_t maxNumItems = 1 << 27;
+
+
+// Load a binary rectangle list from a file. If the file doesn't
+// start with the magic, returns false without touching items so
+// that the caller can fall back to the text format. Invalid files
+// are fatal errors.
+//
+// On systems that support it, the file is memory-mapped, and
+// records are decoded directly from the mapping into items.
+bool load(const char* fileName, std::vector<Item>& items);
+
+// Same as load(), but for streams that can't be mapped, like stdin.
+// Only the first byte is examined before deciding whether the stream
+// is in the binary format; it's put back with ungetc() if not.
+bool loadFp(std::FILE* fp, const char* name, std::vector<Item>& items);
+
+// Write items as a binary rectangle list. Runs of items with the same
+// size are stored as a single record. 16-bit integers are used if all
+// values fit in them.
+void save(const char* fileName, const std::vector<Item>& items);
+
+
+}
@@ -1,7 +1,9 @@
 
 #include "bitmap_canvas.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 #include <png.h>
@@ -25,13 +27,18 @@ static std::uint8_t getStrokeColorIdx(int rectIdx)
 }
 
 
-BitmapCanvas::BitmapCanvas(int w, int h)
+BitmapCanvas::BitmapCanvas(int w, int h, Mode mode)
     : w(w)
     , h(h)
-    , data(w * h)
+    , mode(mode)
+    , data()
+    , rects()
 {
     assert(w > 0);
     assert(h > 0);
+
+    if (mode == Mode::buffer)
+        data.resize(static_cast<std::size_t>(w) * h);
 }
 
 
@@ -46,11 +53,94 @@ void BitmapCanvas::drawRect(const Rect& rect, int rectIdx)
     if (rect.w == 0 || rect.h == 0)
         return;
 
+    if (mode == Mode::scanline) {
+        rects.push_back(ScanlineRect(rect, rectIdx));
+        return;
+    }
+
     fillRect(rect, getFillColorIdx(rectIdx));
     strokeRect(rect, getStrokeColorIdx(rectIdx));
 }
 
 
+// Produces rows of the image from top to bottom, keeping only the
+// rects that intersect the current row. The result is identical to
+// what fillRect() and strokeRect() draw into the buffer.
+//
+// The rects are visited in order of their top edges through an array
+// of 32-bit indices rather than a sorted copy, which would double
+// the memory the scanline mode is meant to save.
+class BitmapCanvas::RowGenerator {
+public:
+    RowGenerator(int w, const std::vector<ScanlineRect>& rects)
+        : row(w)
+        , rects(rects)
+        , order(rects.size())
+        , nextOrderIdx(0)
+        , active()
+        , y(0)
+    {
+        assert(rects.size() <= UINT32_MAX);
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+
+        std::sort(
+            order.begin(), order.end(),
+            [&rects](std::uint32_t a, std::uint32_t b)
+            {
+                return rects[a].rect.y < rects[b].rect.y;
+            });
+    }
+
+    const std::uint8_t* next()
+    {
+        active.erase(
+            std::remove_if(
+                active.begin(), active.end(),
+                [this](const ScanlineRect* r)
+                {
+                    return r->rect.y + r->rect.h <= y;
+                }),
+            active.end());
+
+        while (nextOrderIdx < order.size()
+                && rects[order[nextOrderIdx]].rect.y == y)
+            active.push_back(&rects[order[nextOrderIdx++]]);
+
+        std::memset(row.data(), 0, row.size());
+        for (const auto* r : active)
+            drawRow(*r);
+
+        ++y;
+        return row.data();
+    }
+private:
+    std::vector<std::uint8_t> row;
+    const std::vector<ScanlineRect>& rects;
+    std::vector<std::uint32_t> order;
+    std::size_t nextOrderIdx;
+    std::vector<const ScanlineRect*> active;
+    int y;
+
+    void drawRow(const ScanlineRect& r)
+    {
+        const auto& rect = r.rect;
+        const auto strokeColorIdx = getStrokeColorIdx(r.rectIdx);
+        auto* dst = &row[rect.x];
+
+        if (y == rect.y || y == rect.y + rect.h - 1) {
+            std::memset(dst, strokeColorIdx, rect.w);
+            return;
+        }
+
+        if (rect.w > 2)
+            std::memset(dst + 1, getFillColorIdx(r.rectIdx), rect.w - 2);
+        dst[0] = strokeColorIdx;
+        dst[rect.w - 1] = strokeColorIdx;
+    }
+};
+
+
 const char* BitmapCanvas::getFileExtension() const
 {
     return ".png";
@@ -70,7 +160,7 @@ static int getPaletteBitDepth(int numColors)
 }
 
 
-void BitmapCanvas::save(std::FILE* fp) const
+bool BitmapCanvas::save(std::FILE* fp) const
 {
     assert(fp);
 
@@ -78,19 +168,19 @@ void BitmapCanvas::save(std::FILE* fp) const
         PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
     if (!png_ptr) {
         std::printf("libpng can't create write struct\n");
-        return;
+        return false;
     }
 
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
         png_destroy_write_struct(&png_ptr, nullptr);
         std::printf("libpng can't create info struct\n");
-        return;
+        return false;
     }
 
     if (setjmp(png_jmpbuf(png_ptr))) {
         png_destroy_write_struct(&png_ptr, &info_ptr);
-        return;
+        return false;
     }
 
     png_init_io(png_ptr, fp);
@@ -124,18 +214,27 @@ void BitmapCanvas::save(std::FILE* fp) const
     png_write_info(png_ptr, info_ptr);
     png_set_packing(png_ptr);
 
-    auto* row = const_cast<png_bytep>(static_cast<const png_byte*>(&data[0]));
-    for (int i = 0; i < h; ++i)
-        png_write_row(png_ptr, row + i * w);
+    if (mode == Mode::scanline) {
+        RowGenerator rowGenerator(w, rects);
+        for (int i = 0; i < h; ++i)
+            png_write_row(
+                png_ptr, const_cast<png_bytep>(rowGenerator.next()));
+    } else {
+        auto* row = const_cast<png_bytep>(
+            static_cast<const png_byte*>(&data[0]));
+        for (int i = 0; i < h; ++i)
+            png_write_row(png_ptr, row + static_cast<std::size_t>(i) * w);
+    }
 
     png_write_end(png_ptr, info_ptr);
     png_destroy_write_struct(&png_ptr, &info_ptr);
+    return true;
 }
 
 
 void BitmapCanvas::fillRect(const Rect& rect, std::uint8_t colorIdx)
 {
-    auto* dst = &data[rect.y * w + rect.x];
+    auto* dst = &data[static_cast<std::size_t>(rect.y) * w + rect.x];
     for (int i = 0; i < rect.h; ++i) {
         std::memset(dst, colorIdx, rect.w);
         dst += w;
@@ -145,7 +244,7 @@ void BitmapCanvas::fillRect(const Rect& rect, std::uint8_t colorIdx)
 
 void BitmapCanvas::strokeRect(const Rect& rect, std::uint8_t colorIdx)
 {
-    auto* dst = &data[rect.y * w + rect.x];
+    auto* dst = &data[static_cast<std::size_t>(rect.y) * w + rect.x];
     std::memset(dst, colorIdx, rect.w);
     if (rect.h == 1)
         return;
@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <cstdint>
@@ -9,17 +8,41 @@
 
 class BitmapCanvas : public Canvas {
 public:
-    BitmapCanvas(int w, int h);
+    enum class Mode {
+        // Draw into a w * h buffer.
+        buffer,
+        // Only remember the rects, and rasterize each row of the
+        // image on demand while saving. Memory usage is proportional
+        // to the width of the page and the number of rects rather than
+        // to the page area.
+        scanline,
+    };
+
+    BitmapCanvas(int w, int h, Mode mode = Mode::buffer);
 
     void drawRect(const Rect& rect, int rectIdx) override;
 
     const char* getFileExtension() const override;
-    void save(std::FILE* fp) const override;
+    bool save(std::FILE* fp) const override;
 private:
+    struct ScanlineRect {
+        Rect rect;
+        int rectIdx;
+
+        ScanlineRect(const Rect& rect, int rectIdx)
+            : rect(rect)
+            , rectIdx(rectIdx)
+        {}
+    };
+
     int w;
     int h;
+    Mode mode;
     std::vector<std::uint8_t> data;
+    std::vector<ScanlineRect> rects;
 
     void fillRect(const Rect& rect, std::uint8_t colorIdx);
     void strokeRect(const Rect& rect, std::uint8_t colorIdx);
+
+    class RowGenerator;
 };
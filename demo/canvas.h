@@ -13,5 +13,8 @@ public:
     virtual void drawRect(const Rect& rect, int rectIdx) = 0;
 
     virtual const char* getFileExtension() const = 0;
-    virtual void save(std::FILE* fp) const = 0;
+
+    // Returns false and prints a message if the image can't be
+    // written or drawn.
+    virtual bool save(std::FILE* fp) const = 0;
 };
@@ -0,0 +1,93 @@
+#include "image_canvas.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "png_io.h"
+
+
+const int bytesPerPixel = 4;
+
+
+ImageCanvas::ImageCanvas(
+        int w, int h,
+        const std::vector<std::string>& imagePaths, int extrude)
+    : w(w)
+    , h(h)
+    , imagePaths(imagePaths)
+    , extrude(extrude)
+    , pixels(static_cast<std::size_t>(w) * h * bytesPerPixel)
+    , failed(false)
+{
+    assert(w > 0);
+    assert(h > 0);
+    assert(extrude >= 0);
+}
+
+
+void ImageCanvas::drawRect(const Rect& rect, int rectIdx)
+{
+    assert(rect.x - extrude >= 0);
+    assert(rect.x + rect.w + extrude <= w);
+    assert(rect.y - extrude >= 0);
+    assert(rect.y + rect.h + extrude <= h);
+    assert(rectIdx >= 0);
+    assert(static_cast<std::size_t>(rectIdx) < imagePaths.size());
+
+    if (failed || rect.w == 0 || rect.h == 0)
+        return;
+
+    const auto* path = imagePaths[rectIdx].c_str();
+    PngImage image;
+    if (!png_io::read(path, image)) {
+        failed = true;
+        return;
+    }
+
+    if (image.w != rect.w || image.h != rect.h) {
+        std::fprintf(
+            stderr, "%s changed size while building the atlas\n", path);
+        failed = true;
+        return;
+    }
+
+    const std::size_t stride = static_cast<std::size_t>(w) * bytesPerPixel;
+    const std::size_t srcStride = (
+        static_cast<std::size_t>(image.w) * bytesPerPixel);
+
+    // Copy rows with the edge rows and columns repeated extrude times.
+    auto* dstRow = (
+        &pixels[0]
+        + (rect.y - extrude) * stride
+        + (rect.x - extrude) * bytesPerPixel);
+    for (int y = -extrude; y < rect.h + extrude; ++y) {
+        const int srcY = y < 0 ? 0 : (y >= rect.h ? rect.h - 1 : y);
+        const auto* srcRow = &image.pixels[srcY * srcStride];
+
+        auto* dst = dstRow;
+        for (int i = 0; i < extrude; ++i, dst += bytesPerPixel)
+            std::memcpy(dst, srcRow, bytesPerPixel);
+
+        std::memcpy(dst, srcRow, srcStride);
+        dst += srcStride;
+
+        const auto* lastPixel = srcRow + srcStride - bytesPerPixel;
+        for (int i = 0; i < extrude; ++i, dst += bytesPerPixel)
+            std::memcpy(dst, lastPixel, bytesPerPixel);
+
+        dstRow += stride;
+    }
+}
+
+
+const char* ImageCanvas::getFileExtension() const
+{
+    return ".png";
+}
+
+
+bool ImageCanvas::save(std::FILE* fp) const
+{
+    return !failed && png_io::write(fp, w, h, pixels.data());
+}
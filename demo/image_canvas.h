@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "canvas.h"
+
+
+// Canvas for texture atlases. Instead of drawing a box, drawRect()
+// decodes the PNG imagePaths[rectIdx] and copies its pixels to the
+// rect, so only one decoded image is held at a time.
+class ImageCanvas : public Canvas {
+public:
+    // If extrude > 0, edge pixels of every image are repeated extrude
+    // times around it; the rects passed to drawRect() should have
+    // that much free space on each side.
+    ImageCanvas(
+        int w, int h,
+        const std::vector<std::string>& imagePaths, int extrude);
+
+    void drawRect(const Rect& rect, int rectIdx) override;
+
+    const char* getFileExtension() const override;
+    bool save(std::FILE* fp) const override;
+private:
+    int w;
+    int h;
+    const std::vector<std::string>& imagePaths;
+    int extrude;
+    std::vector<std::uint8_t> pixels;
+    // Whether an image couldn't be drawn. drawRect() runs on worker
+    // threads, so it reports errors through save() instead of
+    // exiting.
+    bool failed;
+};
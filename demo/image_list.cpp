@@ -0,0 +1,157 @@
+#include "image_list.h"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+#ifdef _WIN32
+#include <stdlib.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "parallel.h"
+#include "png_io.h"
+
+
+namespace image_list {
+
+
+static std::string getAbsolutePath(const std::string& path)
+{
+#ifdef _WIN32
+    char buf[_MAX_PATH];
+    if (_fullpath(buf, path.c_str(), sizeof(buf)))
+        return buf;
+#else
+    char buf[PATH_MAX];
+    if (realpath(path.c_str(), buf))
+        return buf;
+#endif
+
+    std::fprintf(
+        stderr, "Can't resolve %s: %s\n", path.c_str(), std::strerror(errno));
+    std::exit(EXIT_FAILURE);
+}
+
+
+static bool hasPngExtension(const char* name)
+{
+    const auto len = std::strlen(name);
+    if (len < 4)
+        return false;
+
+    const char* ext = name + len - 4;
+    for (int i = 0; i < 4; ++i)
+        if (std::tolower(ext[i]) != ".png"[i])
+            return false;
+
+    return true;
+}
+
+
+#ifndef _WIN32
+
+
+static bool isDirectory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+static std::vector<std::string> collectDirectory(const char* path)
+{
+    DIR* dir = opendir(path);
+    if (!dir) {
+        std::fprintf(
+            stderr, "Can't open directory %s: %s\n",
+            path, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> paths;
+    while (const auto* entry = readdir(dir))
+        if (hasPngExtension(entry->d_name))
+            paths.push_back(
+                getAbsolutePath(std::string(path) + "/" + entry->d_name));
+
+    closedir(dir);
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+
+#endif
+
+
+static std::vector<std::string> collectList(const char* path)
+{
+    std::FILE* fp = std::fopen(path, "r");
+    if (!fp) {
+        std::fprintf(
+            stderr,
+            "Can't open %s for reading: %s\n", path, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> paths;
+
+    static char line[PATH_MAX + 2];
+    while (std::fgets(line, sizeof(line), fp)) {
+        line[std::strcspn(line, "\r\n")] = 0;
+        if (line[0])
+            paths.push_back(getAbsolutePath(line));
+    }
+
+    std::fclose(fp);
+    return paths;
+}
+
+
+std::vector<std::string> collectPaths(const char* path)
+{
+#ifndef _WIN32
+    if (isDirectory(path))
+        return collectDirectory(path);
+#endif
+
+    return collectList(path);
+}
+
+
+std::vector<Item> loadItems(
+    const std::vector<std::string>& paths, int extrude, int numJobs)
+{
+    std::vector<Item> items(paths.size(), Item(0, 0));
+    std::atomic<bool> failed(false);
+
+    parallelFor(
+        paths.size(), numJobs,
+        [&](std::size_t i)
+        {
+            int w, h;
+            if (!png_io::readSize(paths[i].c_str(), w, h)) {
+                failed = true;
+                return;
+            }
+
+            items[i] = Item(w + extrude * 2, h + extrude * 2);
+            items[i].idx = i;
+        });
+
+    if (failed)
+        std::exit(EXIT_FAILURE);
+
+    return items;
+}
+
+
+}
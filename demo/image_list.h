@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "item.h"
+
+
+namespace image_list {
+
+
+// If path is a directory, return all .png files in it sorted by
+// name. Otherwise, path should be a text file with one PNG path per
+// line. Returned paths are absolute, so they stay valid after
+// changing the working directory.
+std::vector<std::string> collectPaths(const char* path);
+
+// Read sizes of the images using numJobs threads. Only PNG headers
+// are decoded at this point. Each item is extended by extrude on
+// every side, and Item::idx is the index in paths.
+std::vector<Item> loadItems(
+    const std::vector<std::string>& paths, int extrude, int numJobs);
+
+
+}
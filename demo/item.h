@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rect.h"
+
+
+struct Item {
+    // pageIdx of an item that was not packed.
+    static const std::size_t noPage = SIZE_MAX;
+
+    Rect rect;
+    std::size_t pageIdx;
+    // Index of the item in the input.
+    std::size_t idx;
+
+    Item(int w, int h)
+        : rect(0, 0, w, h)
+        , pageIdx(0)
+        , idx(0)
+    {}
+};
@@ -1,29 +1,55 @@
 
 #include <cassert>
 #include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
 #include <memory>
+#include <string>
 #include <vector>
 
 #ifdef _WIN32
 #include <direct.h>
 #define chdir _chdir
 #else
+#include <poll.h>
 #include <unistd.h>
 #endif
 
 #include "args.h"
+#include "binary_rects.h"
 #include "bitmap_canvas.h"
 #include "dp_rect_pack.h"
+#include "image_canvas.h"
+#include "image_list.h"
+#include "item.h"
+#include "manifest.h"
+#include "parallel.h"
 #include "rect.h"
 #include "svg_canvas.h"
+#include "trace.h"
 
 
 int maxPagesDigits;
 
+// Images of the atlas, indexed by Item::idx.
+std::vector<std::string> imagePaths;
+
+// PNG pages with more pixels are rendered row by row instead of
+// allocating a buffer for the whole page.
+const std::size_t maxBufferedPngPixels = 64 * 1024 * 1024;
+
+// With -trace, the number of pages and free nodes is sampled after
+// every traceCounterInterval runs of same-sized rects.
+const std::size_t traceCounterInterval = 64;
+
 
 static int numDigits(int i)
 {
@@ -36,17 +62,6 @@ static int numDigits(int i)
 }
 
 
-struct Item {
-    Rect rect;
-    std::size_t pageIdx;
-
-    Item(int w, int h)
-        : rect(0, 0, w, h)
-        , pageIdx(0)
-    {}
-};
-
-
 static std::vector<Item> loadItemsFp(std::FILE* fp)
 {
     std::vector<Item> items;
@@ -79,6 +94,10 @@ static std::vector<Item> loadItemsFp(std::FILE* fp)
 
 static std::vector<Item> loadItems(const char* fileName)
 {
+    std::vector<Item> items;
+    if (binary_rects::load(fileName, items))
+        return items;
+
     std::FILE* fp = std::fopen(fileName, "r");
     if (!fp) {
         std::fprintf(
@@ -87,7 +106,7 @@ static std::vector<Item> loadItems(const char* fileName)
         std::exit(EXIT_FAILURE);
     }
 
-    auto items = loadItemsFp(fp);
+    items = loadItemsFp(fp);
     std::fclose(fp);
     return items;
 }
@@ -102,9 +121,35 @@ static bool compareItemsByRect(const Item& a, const Item& b)
 }
 
 
+// Tell the packer the minimum size of items, so that it can drop
+// free nodes that can't hold any of them.
+template<typename Packer>
+static void setMinRectSize(Packer& packer, const std::vector<Item>& items)
+{
+    int minW = INT_MAX;
+    int minH = INT_MAX;
+    for (const auto& item : items) {
+        minW = std::min(minW, item.rect.w);
+        minH = std::min(minH, item.rect.h);
+    }
+
+    packer.setMinRectSize(minW, minH);
+}
+
+
+// Return the page whose items the item is rendered with. Items
+// that were not packed are grouped with page 0 (but not drawn), so
+// that they take color indices just like when the demo zeroed their
+// rects, and colors of other items don't change.
+static std::size_t getRenderPageIdx(const Item& item)
+{
+    return item.pageIdx == Item::noPage ? 0 : item.pageIdx;
+}
+
+
 static bool compareItemsByPageIdx(const Item& a, const Item& b)
 {
-    return a.pageIdx < b.pageIdx;
+    return getRenderPageIdx(a) < getRenderPageIdx(b);
 }
 
 
@@ -133,7 +178,9 @@ static const char* getInsertStatusString(
 }
 
 
-static void saveCanvas(const Canvas& canvas, std::size_t pageIdx)
+// Save the canvas to a file named after the page. Runs on worker
+// threads, so errors are printed and returned rather than fatal.
+static bool saveCanvas(const Canvas& canvas, std::size_t pageIdx)
 {
     assert(maxPagesDigits > 0);
     assert(pageIdx <= static_cast<std::size_t>(args::maxPages));
@@ -151,25 +198,495 @@ static void saveCanvas(const Canvas& canvas, std::size_t pageIdx)
             stderr,
             "Can't open %s for writing: %s\n",
             name, std::strerror(errno));
-        std::exit(EXIT_FAILURE);
+        return false;
     }
 
-    canvas.save(fp);
-    std::fclose(fp);
+    bool saved;
+    {
+        trace::Span span("encode", pageIdx);
+        saved = canvas.save(fp);
+    }
+
+    if (std::fclose(fp) != 0 && saved) {
+        std::fprintf(
+            stderr, "Can't write %s: %s\n", name, std::strerror(errno));
+        saved = false;
+    }
+
+    return saved;
+}
+
+
+// Returns false if the page can't be saved; see saveCanvas().
+static bool renderPage(
+    int pageW, int pageH, std::size_t pageIdx,
+    const std::vector<Item>& items,
+    std::size_t itemsBegin, std::size_t itemsEnd)
+{
+    if (pageW == 0 || pageH == 0)
+        return true;
+
+    trace::Span span("render", pageIdx);
+
+    std::unique_ptr<Canvas> canvas;
+    switch (args::imageFormat) {
+        case args::ImageFormat::png:
+            if (args::atlas) {
+                canvas.reset(
+                    new ImageCanvas(
+                        pageW, pageH, imagePaths, args::extrude));
+                break;
+            }
+
+            canvas.reset(
+                new BitmapCanvas(
+                    pageW, pageH,
+                    static_cast<std::size_t>(pageW) * pageH
+                            > maxBufferedPngPixels
+                        ? BitmapCanvas::Mode::scanline
+                        : BitmapCanvas::Mode::buffer));
+            break;
+        case args::ImageFormat::svg:
+            canvas.reset(new SvgCanvas(pageW, pageH));
+            break;
+        case args::ImageFormat::svgz:
+            canvas.reset(new SvgCanvas(pageW, pageH, true));
+            break;
+        default:
+            assert(false);
+            break;
+    }
+
+    // Color of a rectangle depends on its index in the array sorted
+    // by page, so the output doesn't depend on the number of jobs.
+    // For atlases, the index selects the image instead.
+    for (auto itemIdx = itemsBegin; itemIdx < itemsEnd; ++itemIdx) {
+        const auto& item = items[itemIdx];
+        assert(getRenderPageIdx(item) == pageIdx);
+        if (item.pageIdx == Item::noPage)
+            continue;
+
+        canvas->drawRect(item.rect, args::atlas ? item.idx : itemIdx);
+    }
+
+    return saveCanvas(*canvas, pageIdx);
+}
+
+
+// Apply options that don't affect the geometry of pages.
+template<typename Packer>
+static void configurePacker(Packer& packer)
+{
+    packer.setSearchThreads(args::jobs);
+    packer.setFixedPageSize(args::fixedSize);
+
+    switch (args::pageSelection) {
+        case args::PageSelection::firstFit:
+            packer.setPageSelection(dp::rect_pack::PageSelection::firstFit);
+            break;
+        case args::PageSelection::lastPages:
+            packer.setPageSelection(
+                dp::rect_pack::PageSelection::lastPages, args::numLastPages);
+            break;
+        case args::PageSelection::bestFit:
+            packer.setPageSelection(dp::rect_pack::PageSelection::bestFit);
+            break;
+    }
+}
+
+
+// Reads lines from a file with an optional timeout, so that the
+// caller can do periodic work while input is idle. On Windows, the
+// timeout is ignored.
+class LineReader {
+public:
+    enum class Result {
+        line,
+        timeout,
+        end,
+    };
+
+    explicit LineReader(std::FILE* fp)
+        : fp(fp)
+        , buf()
+        , pos(0)
+        , atEnd(false)
+    {}
+
+    // Read the next line without the newline. A negative timeout
+    // waits forever.
+    Result read(std::string& line, int timeoutMs);
+private:
+    std::FILE* fp;
+    std::string buf;
+    // Start of the unread part of buf.
+    std::size_t pos;
+    bool atEnd;
+};
+
+
+LineReader::Result LineReader::read(std::string& line, int timeoutMs)
+{
+#ifdef _WIN32
+    (void)timeoutMs;
+
+    static char chunk[128];
+    if (!std::fgets(chunk, sizeof(chunk), fp))
+        return Result::end;
+
+    line = chunk;
+    if (!line.empty() && line.back() == '\n')
+        line.pop_back();
+    return Result::line;
+#else
+    // We read the file descriptor directly since poll() doesn't know
+    // about data buffered by stdio.
+    using Clock = std::chrono::steady_clock;
+    const auto deadline = Clock::now() + std::chrono::milliseconds(
+        timeoutMs);
+
+    while (true) {
+        const auto lineEnd = buf.find('\n', pos);
+        if (lineEnd != buf.npos || (atEnd && pos < buf.size())) {
+            const auto end = lineEnd != buf.npos ? lineEnd : buf.size();
+            line.assign(buf, pos, end - pos);
+            pos = end + 1;
+            return Result::line;
+        }
+
+        if (atEnd)
+            return Result::end;
+
+        buf.erase(0, pos);
+        pos = 0;
+
+        if (timeoutMs >= 0) {
+            const auto remaining = std::chrono::duration_cast<
+                std::chrono::milliseconds>(deadline - Clock::now()).count();
+            pollfd pollFd = {fileno(fp), POLLIN, 0};
+            const int numReady = poll(
+                &pollFd, 1, std::max<decltype(remaining)>(remaining, 0));
+            if (numReady == 0)
+                return Result::timeout;
+            if (numReady < 0 && errno == EINTR)
+                continue;
+        }
+
+        char chunk[1 << 16];
+        const auto n = ::read(fileno(fp), chunk, sizeof(chunk));
+        if (n > 0)
+            buf.append(chunk, n);
+        else if (n == 0 || errno != EINTR)
+            atEnd = true;
+    }
+#endif
+}
+
+
+// Pack rects as they are read, one line at a time. Every inserted
+// rect is reported as "rect PAGE X Y"; if the insertion created
+// a page or changed its size, "page PAGE W H" comes before that.
+// Invalid lines and failed insertions are reported as "error TEXT".
+// Output is flushed after each input line.
+//
+// With -reorder, rects go through a ReorderWindow, and "rect" and
+// "error" lines of insertions are followed by the index of the rect
+// in the input, since rects are no longer packed in input order.
+static void runStream(std::FILE* fp)
+{
+    using Packer = dp::rect_pack::RectPacker<>;
+    Packer packer(
+        args::maxPageSize[0], args::maxPageSize[1],
+        Packer::Spacing(args::spacing[0], args::spacing[1]),
+        Packer::Padding(
+            args::padding[0], args::padding[1],
+            args::padding[2], args::padding[3]));
+    configurePacker(packer);
+
+    struct PageSize {
+        int w;
+        int h;
+    };
+    std::vector<PageSize> pageSizes;
+
+    const auto report = [&](
+        std::size_t rectIdx, const Packer::InsertResult& result)
+    {
+        if (result.status != dp::rect_pack::InsertStatus::ok) {
+            std::printf("error %s", getInsertStatusString(result.status));
+        } else {
+            if (result.pageIndex >= pageSizes.size())
+                pageSizes.resize(result.pageIndex + 1, PageSize{0, 0});
+
+            auto& pageSize = pageSizes[result.pageIndex];
+            int pageW, pageH;
+            packer.getPageSize(result.pageIndex, pageW, pageH);
+            if (pageW != pageSize.w || pageH != pageSize.h) {
+                pageSize.w = pageW;
+                pageSize.h = pageH;
+                std::printf(
+                    "page %zu %i %i\n", result.pageIndex, pageW, pageH);
+            }
+
+            std::printf(
+                "rect %zu %i %i",
+                result.pageIndex, result.pos.x, result.pos.y);
+        }
+
+        if (args::reorder > 0)
+            std::printf(" %zu", rectIdx);
+        std::printf("\n");
+    };
+
+    using Clock = std::chrono::steady_clock;
+    const auto startTime = Clock::now();
+    const auto getTime = [&]()
+    {
+        return std::chrono::duration<double, std::micro>(
+            Clock::now() - startTime).count();
+    };
+
+    dp::rect_pack::ReorderWindow<int, decltype(report)> window(
+        packer, report, args::reorder);
+    window.setMaxDelay(args::reorderDelay);
+    // Time when the oldest rect in the window was added.
+    double oldestTime = 0;
+
+    LineReader reader(fp);
+    std::size_t rectIdx = 0;
+    std::string line;
+    while (true) {
+        // Wake up when the oldest rect is due even if no input comes.
+        int timeoutMs = -1;
+        if (args::reorderDelay > 0 && window.getNumPending() > 0)
+            timeoutMs = static_cast<int>(std::max(
+                0.0,
+                std::ceil((oldestTime + args::reorderDelay - getTime())
+                    / 1000.0)));
+
+        const auto readResult = reader.read(line, timeoutMs);
+        if (readResult == LineReader::Result::end)
+            break;
+        else if (readResult == LineReader::Result::timeout) {
+            window.poll(getTime());
+            std::fflush(stdout);
+            continue;
+        }
+
+        int w, h, count;
+
+        const auto numRead = std::sscanf(
+            line.c_str(), "%dx%dx%d", &w, &h, &count);
+        if (numRead == EOF)
+            continue;
+        else if (numRead < 2) {
+            std::printf("error invalid rectangle description\n");
+            std::fflush(stdout);
+            continue;
+        } else if (numRead == 2)
+            count = 1;
+
+        if (args::reorder > 0) {
+            const auto time = getTime();
+            if (window.getNumPending() == 0)
+                oldestTime = time;
+            for (int i = 0; i < count; ++i)
+                window.add(w, h, rectIdx++, time);
+        } else
+            for (int i = 0; i < count; ++i) {
+                const auto result = packer.insert(w, h);
+                report(rectIdx++, result);
+                if (result.status != dp::rect_pack::InsertStatus::ok)
+                    break;
+            }
+
+        std::fflush(stdout);
+    }
+
+    window.flush();
+    std::fflush(stdout);
+}
+
+
+struct PackStats {
+    std::size_t numPages;
+    double totalPageArea;
+    dp::rect_pack::PageSelectionStats pageSelectionStats;
+};
+
+
+template<typename GeomT>
+static PackStats packForBenchmark(const std::vector<Item>& items)
+{
+    using Packer = dp::rect_pack::RectPacker<GeomT>;
+    Packer packer(
+        args::maxPageSize[0], args::maxPageSize[1],
+        typename Packer::Spacing(args::spacing[0], args::spacing[1]),
+        typename Packer::Padding(
+            args::padding[0], args::padding[1],
+            args::padding[2], args::padding[3]));
+    configurePacker(packer);
+    setMinRectSize(packer, items);
+    for (const auto& item : items)
+        packer.insert(item.rect.w, item.rect.h);
+
+    PackStats stats{
+        packer.getNumPages(),
+        0.0,
+        packer.getPageSelectionStats(packer.getPageSelection())};
+    for (std::size_t i = 0; i < packer.getNumPages(); ++i) {
+        GeomT w, h;
+        packer.getPageSize(i, w, h);
+        stats.totalPageArea += static_cast<double>(w) * h;
+    }
+
+    return stats;
+}
+
+
+// Returns the value with the given nearest rank (0 to 100).
+static double getPercentile(std::vector<double> values, int percentile)
+{
+    assert(!values.empty());
+    std::sort(values.begin(), values.end());
+
+    auto rank = (values.size() * percentile + 99) / 100;
+    if (rank > 0)
+        --rank;
+    return values[rank];
+}
+
+
+static void runBenchmark(int numRuns)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto getMs = [](Clock::time_point start, Clock::time_point end)
+    {
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+
+    const char* phaseNames[] = {"load", "sort", "pack"};
+    const int numPhases = sizeof(phaseNames) / sizeof(*phaseNames);
+    std::vector<double> times[numPhases];
+
+    std::size_t numItems = 0;
+    PackStats packStats{};
+
+    for (int run = 0; run < numRuns; ++run) {
+        const auto loadStart = Clock::now();
+        auto items = loadItems(args::inFile);
+
+        const auto sortStart = Clock::now();
+        std::sort(items.begin(), items.end(), compareItemsByRect);
+
+        const auto packStart = Clock::now();
+        switch (args::benchGeomType) {
+            case args::GeomType::int32:
+                packStats = packForBenchmark<std::int32_t>(items);
+                break;
+            case args::GeomType::int64:
+                packStats = packForBenchmark<std::int64_t>(items);
+                break;
+            case args::GeomType::float32:
+                packStats = packForBenchmark<float>(items);
+                break;
+            case args::GeomType::float64:
+                packStats = packForBenchmark<double>(items);
+                break;
+            default:
+                assert(false);
+                break;
+        }
+        const auto packEnd = Clock::now();
+
+        times[0].push_back(getMs(loadStart, sortStart));
+        times[1].push_back(getMs(sortStart, packStart));
+        times[2].push_back(getMs(packStart, packEnd));
+
+        numItems = items.size();
+    }
+
+    std::printf("Runs: %i\n", numRuns);
+    std::printf("Rectangles: %zu\n", numItems);
+    std::printf(
+        "\n%-8s%12s%12s%12s\n", "Phase", "min, ms", "median, ms", "p99, ms");
+    for (int i = 0; i < numPhases; ++i)
+        std::printf(
+            "%-8s%12.3f%12.3f%12.3f\n",
+            phaseNames[i],
+            getPercentile(times[i], 0),
+            getPercentile(times[i], 50),
+            getPercentile(times[i], 99));
+
+    const auto medianPackMs = getPercentile(times[2], 50);
+    std::printf("\n");
+    if (medianPackMs > 0.0)
+        std::printf(
+            "Packing speed: %.0f rects/s (median)\n",
+            numItems / (medianPackMs / 1000.0));
+    std::printf("Pages: %zu\n", packStats.numPages);
+    std::printf("Total page area: %.0f\n", packStats.totalPageArea);
+
+    const auto& selectionStats = packStats.pageSelectionStats;
+    if (selectionStats.numRects > 0)
+        std::printf(
+            "Pages checked per rect: %.2f\n",
+            static_cast<double>(selectionStats.numPagesChecked)
+                / selectionStats.numRects);
 }
 
 
 int main(int argc, char* argv[])
 {
     args::parse(argc, argv);
+    if (args::traceFile[0])
+        trace::start(args::traceFile);
 
     maxPagesDigits = numDigits(args::maxPages);
 
+    if (args::stream) {
+        if (std::strcmp(args::inFile, "-") == 0)
+            runStream(stdin);
+        else {
+            std::FILE* fp = std::fopen(args::inFile, "r");
+            if (!fp) {
+                std::fprintf(
+                    stderr,
+                    "Can't open %s for reading: %s\n",
+                    args::inFile, std::strerror(errno));
+                return EXIT_FAILURE;
+            }
+
+            runStream(fp);
+            std::fclose(fp);
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (args::benchRuns > 0) {
+        runBenchmark(args::benchRuns);
+        return EXIT_SUCCESS;
+    }
+
     std::vector<Item> items;
-    if (std::strcmp(args::inFile, "-") == 0)
-        items = loadItemsFp(stdin);
-    else
-        items = loadItems(args::inFile);
+    {
+        trace::Span span("load");
+        if (args::atlas) {
+            imagePaths = image_list::collectPaths(args::inFile);
+            items = image_list::loadItems(
+                imagePaths, args::extrude, args::jobs);
+        } else if (std::strcmp(args::inFile, "-") == 0) {
+            if (!binary_rects::loadFp(stdin, "stdin", items))
+                items = loadItemsFp(stdin);
+        } else
+            items = loadItems(args::inFile);
+    }
+
+    if (args::binaryRectsOutFile[0]) {
+        binary_rects::save(args::binaryRectsOutFile, items);
+        return EXIT_SUCCESS;
+    }
 
     if (items.empty()) {
         std::printf(
@@ -177,7 +694,13 @@ int main(int argc, char* argv[])
         return EXIT_SUCCESS;
     }
 
-    std::sort(items.begin(), items.end(), compareItemsByRect);
+    for (std::size_t i = 0; i < items.size(); ++i)
+        items[i].idx = i;
+
+    {
+        trace::Span span("sort");
+        std::sort(items.begin(), items.end(), compareItemsByRect);
+    }
 
     using Packer = dp::rect_pack::RectPacker<>;
     Packer packer(
@@ -186,23 +709,77 @@ int main(int argc, char* argv[])
         Packer::Padding(
             args::padding[0], args::padding[1],
             args::padding[2], args::padding[3]));
-    for (auto& item : items) {
-        const auto result = packer.insert(item.rect.w, item.rect.h);
-        if (result.status != dp::rect_pack::InsertStatus::ok) {
-            std::printf(
-                "Can't insert %ix%i rect: %s\n",
-                item.rect.w, item.rect.h,
-                getInsertStatusString(result.status));
-
-            item.rect = Rect();
-            continue;
+    configurePacker(packer);
+
+    const auto traceCounters = [&]()
+    {
+        std::size_t numFreeNodes = 0;
+        for (std::size_t i = 0; i < packer.getNumPages(); ++i)
+            numFreeNodes += packer.getNumFreeNodes(i);
+
+        trace::counter("pages", packer.getNumPages());
+        trace::counter("free nodes", numFreeNodes);
+    };
+
+    {
+        trace::Span span("pack");
+
+        setMinRectSize(packer, items);
+
+        // Items are sorted, so rects of the same size form runs that
+        // can be inserted at once.
+        std::vector<Packer::InsertResult> results;
+        std::size_t runIdx = 0;
+        for (auto runBegin = items.begin(); runBegin != items.end();) {
+            const auto& rect = runBegin->rect;
+            auto runEnd = runBegin + 1;
+            while (runEnd != items.end()
+                    && runEnd->rect.w == rect.w
+                    && runEnd->rect.h == rect.h)
+                ++runEnd;
+
+            results.clear();
+            const auto status = packer.insertRepeated(
+                rect.w, rect.h, runEnd - runBegin,
+                std::back_inserter(results));
+
+            for (auto it = runBegin; it != runEnd; ++it) {
+                auto& item = *it;
+                if (status != dp::rect_pack::InsertStatus::ok) {
+                    std::printf(
+                        "Can't insert %ix%i rect: %s\n",
+                        item.rect.w, item.rect.h,
+                        getInsertStatusString(status));
+
+                    item.pageIdx = Item::noPage;
+                    continue;
+                }
+
+                const auto& result = results[it - runBegin];
+                item.rect.x = result.pos.x;
+                item.rect.y = result.pos.y;
+                item.pageIdx = result.pageIndex;
+            }
+
+            runBegin = runEnd;
+
+            if (trace::enabled && ++runIdx % traceCounterInterval == 0)
+                traceCounters();
         }
 
-        item.rect.x = result.pos.x;
-        item.rect.y = result.pos.y;
-        item.pageIdx = result.pageIndex;
+        if (trace::enabled)
+            traceCounters();
     }
 
+    // Packed rects of atlas images include the extrusion.
+    if (args::atlas && args::extrude > 0)
+        for (auto& item : items) {
+            item.rect.x += args::extrude;
+            item.rect.y += args::extrude;
+            item.rect.w -= args::extrude * 2;
+            item.rect.h -= args::extrude * 2;
+        }
+
     if (packer.getNumPages() > static_cast<std::size_t>(args::maxPages)) {
         std::fprintf(
             stderr,
@@ -211,6 +788,19 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (args::manifestFile[0]) {
+        std::vector<manifest::PageSize> pageSizes(packer.getNumPages());
+        for (std::size_t i = 0; i < pageSizes.size(); ++i)
+            packer.getPageSize(i, pageSizes[i].w, pageSizes[i].h);
+
+        manifest::save(
+            args::manifestFile, args::manifestFormat,
+            pageSizes, items, imagePaths);
+    }
+
+    if (args::imageFormat == args::ImageFormat::none)
+        return EXIT_SUCCESS;
+
     std::sort(items.begin(), items.end(), compareItemsByPageIdx);
 
     if (args::outDir[0] && chdir(args::outDir) != 0) {
@@ -221,37 +811,42 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    // Items of page i are in [pageItemsBegin[i]..pageItemsBegin[i + 1]).
+    std::vector<std::size_t> pageItemsBegin(packer.getNumPages() + 1);
     std::size_t itemIdx = 0;
     for (std::size_t pageIdx = 0; pageIdx < packer.getNumPages(); ++pageIdx) {
-        int pageW, pageH;
-        packer.getPageSize(pageIdx, pageW, pageH);
-        if (pageW == 0 || pageH == 0)
-            continue;
-
-        std::unique_ptr<Canvas> canvas;
-        switch (args::imageFormat) {
-            case args::ImageFormat::png:
-                canvas.reset(new BitmapCanvas(pageW, pageH));
-                break;
-            case args::ImageFormat::svg:
-                canvas.reset(new SvgCanvas(pageW, pageH));
-                break;
-            default:
-                assert(false);
-                break;
-        }
-
-        while (itemIdx < items.size()) {
-            const auto& item = items[itemIdx];
-            if (item.pageIdx != pageIdx)
-                break;
-
-            canvas->drawRect(item.rect, itemIdx);
+        pageItemsBegin[pageIdx] = itemIdx;
+        while (itemIdx < items.size()
+                && getRenderPageIdx(items[itemIdx]) == pageIdx)
             ++itemIdx;
-        }
-
-        saveCanvas(*canvas, pageIdx);
     }
-
-    return EXIT_SUCCESS;
+    pageItemsBegin.back() = itemIdx;
+
+    // Rendering starts only after packing is done: with the default
+    // page selection, any page can still receive rects until the
+    // last insertion, and the page limit and extrusion are applied
+    // to the final layout.
+    //
+    // Pages are independent, so each job takes the next page,
+    // draws, and saves it. At most args::jobs canvases exist at a time.
+    // Jobs must not exit while others are running, so a failure only
+    // stops the remaining pages, and we exit once all jobs are done.
+    std::atomic<bool> failed(false);
+    parallelFor(
+        packer.getNumPages(), args::jobs,
+        [&](std::size_t pageIdx)
+        {
+            if (failed)
+                return;
+
+            int pageW, pageH;
+            packer.getPageSize(pageIdx, pageW, pageH);
+            if (!renderPage(
+                    pageW, pageH, pageIdx,
+                    items,
+                    pageItemsBegin[pageIdx], pageItemsBegin[pageIdx + 1]))
+                failed = true;
+        });
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,225 @@
+#include "manifest.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+namespace manifest {
+
+
+static void writeU32(std::uint8_t* p, std::uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+
+static void saveBin(
+    std::FILE* fp,
+    const std::vector<PageSize>& pageSizes,
+    const std::vector<Item>& items)
+{
+    const std::size_t headerSize = 16;
+    const std::size_t pageSize = 8;
+    const std::size_t rectSize = 20;
+
+    std::vector<std::uint8_t> data(
+        headerSize
+        + pageSizes.size() * pageSize
+        + items.size() * rectSize);
+
+    std::memcpy(&data[0], magic, sizeof(magic));
+    data[4] = version;
+    writeU32(&data[8], pageSizes.size());
+    writeU32(&data[12], items.size());
+
+    auto* p = &data[headerSize];
+    for (const auto& size : pageSizes) {
+        writeU32(p, size.w);
+        writeU32(p + 4, size.h);
+        p += pageSize;
+    }
+
+    auto* rects = p;
+    for (const auto& item : items) {
+        assert(item.idx < items.size());
+        p = rects + item.idx * rectSize;
+
+        writeU32(
+            p,
+            item.pageIdx == Item::noPage ? UINT32_MAX : item.pageIdx);
+        writeU32(p + 4, item.rect.x);
+        writeU32(p + 8, item.rect.y);
+        writeU32(p + 12, item.rect.w);
+        writeU32(p + 16, item.rect.h);
+    }
+
+    std::fwrite(data.data(), 1, data.size(), fp);
+}
+
+
+static std::vector<const Item*> sortByIdx(const std::vector<Item>& items)
+{
+    std::vector<const Item*> result(items.size());
+    for (const auto& item : items) {
+        assert(item.idx < items.size());
+        result[item.idx] = &item;
+    }
+
+    return result;
+}
+
+
+static void writeCsvString(std::FILE* fp, const std::string& str)
+{
+    std::fputc('"', fp);
+    for (const auto c : str) {
+        if (c == '"')
+            std::fputc('"', fp);
+        std::fputc(c, fp);
+    }
+    std::fputc('"', fp);
+}
+
+
+static void saveCsv(
+    std::FILE* fp,
+    const std::vector<PageSize>& pageSizes,
+    const std::vector<Item>& items,
+    const std::vector<std::string>& names)
+{
+    std::fputs("index,page,x,y,w,h,page_w,page_h", fp);
+    std::fputs(names.empty() ? "\n" : ",name\n", fp);
+
+    for (const auto* item : sortByIdx(items)) {
+        const auto& rect = item->rect;
+        if (item->pageIdx == Item::noPage)
+            std::fprintf(
+                fp, "%zu,,,,%i,%i,,", item->idx, rect.w, rect.h);
+        else {
+            assert(item->pageIdx < pageSizes.size());
+            const auto& pageSize = pageSizes[item->pageIdx];
+            std::fprintf(
+                fp, "%zu,%zu,%i,%i,%i,%i,%i,%i",
+                item->idx, item->pageIdx,
+                rect.x, rect.y, rect.w, rect.h,
+                pageSize.w, pageSize.h);
+        }
+
+        if (!names.empty()) {
+            std::fputc(',', fp);
+            writeCsvString(fp, names[item->idx]);
+        }
+
+        std::fputc('\n', fp);
+    }
+}
+
+
+static void writeJsonString(std::FILE* fp, const std::string& str)
+{
+    std::fputc('"', fp);
+    for (const auto c : str) {
+        if (c == '"' || c == '\\')
+            std::fprintf(fp, "\\%c", c);
+        else if (static_cast<unsigned char>(c) < 0x20)
+            std::fprintf(fp, "\\u%04x", c);
+        else
+            std::fputc(c, fp);
+    }
+    std::fputc('"', fp);
+}
+
+
+static void saveJson(
+    std::FILE* fp,
+    const std::vector<PageSize>& pageSizes,
+    const std::vector<Item>& items,
+    const std::vector<std::string>& names)
+{
+    std::fputs("{\n  \"pages\": [", fp);
+    for (std::size_t i = 0; i < pageSizes.size(); ++i)
+        std::fprintf(
+            fp, "%s\n    {\"w\": %i, \"h\": %i}",
+            i > 0 ? "," : "",
+            pageSizes[i].w, pageSizes[i].h);
+    std::fputs("\n  ],\n  \"rects\": [", fp);
+
+    const char* separator = "";
+    for (const auto* item : sortByIdx(items)) {
+        std::fprintf(
+            fp, "%s\n    {\"index\": %zu, \"page\": ",
+            separator, item->idx);
+        if (item->pageIdx == Item::noPage)
+            std::fputs("null", fp);
+        else
+            std::fprintf(fp, "%zu", item->pageIdx);
+
+        const auto& rect = item->rect;
+        std::fprintf(
+            fp, ", \"x\": %i, \"y\": %i, \"w\": %i, \"h\": %i",
+            rect.x, rect.y, rect.w, rect.h);
+
+        if (!names.empty()) {
+            std::fputs(", \"name\": ", fp);
+            writeJsonString(fp, names[item->idx]);
+        }
+
+        std::fputc('}', fp);
+
+        separator = ",";
+    }
+    std::fputs("\n  ]\n}\n", fp);
+}
+
+
+void save(
+    const char* fileName,
+    Format format,
+    const std::vector<PageSize>& pageSizes,
+    const std::vector<Item>& items,
+    const std::vector<std::string>& names)
+{
+    assert(names.empty() || names.size() == items.size());
+
+    std::FILE* fp = std::fopen(fileName, "wb");
+    if (!fp) {
+        std::fprintf(
+            stderr,
+            "Can't open %s for writing: %s\n",
+            fileName, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    switch (format) {
+        case Format::bin:
+            saveBin(fp, pageSizes, items);
+            break;
+        case Format::csv:
+            saveCsv(fp, pageSizes, items, names);
+            break;
+        case Format::json:
+            saveJson(fp, pageSizes, items, names);
+            break;
+        default:
+            assert(false);
+            break;
+    }
+
+    if (std::ferror(fp)) {
+        std::fprintf(
+            stderr, "Can't write %s: %s\n", fileName, std::strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::fclose(fp);
+}
+
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "item.h"
+
+
+// Placement manifest.
+//
+// A manifest lists page sizes and, for every input rectangle, its
+// index in the input, page, and geometry. It can be written in three
+// formats:
+//
+//   bin   A compact binary layout intended to be memory-mapped.
+//   csv   One row per rectangle, including the size of its page.
+//   json  {"pages": [{"w", "h"}...], "rects": [{"index", "page",
+//         "x", "y", "w", "h"}...]}
+//
+// In all formats, rectangles are listed in input order. csv and json
+// can also have a name for every rectangle, like an image path. Rectangles
+// that were not packed have page 0xFFFFFFFF in bin, an empty page in
+// csv, and null page in json.
+//
+// Binary layout (all integers are little-endian):
+//
+//   Offset  Size  Description
+//   0       4     Magic: "DPRM"
+//   4       1     Format version (1)
+//   5       3     Reserved; 0
+//   8       4     Number of pages (P)
+//   12      4     Number of rectangles (R)
+//   16      8*P   Pages: width and height as int32
+//   16+8*P  20*R  Rectangles: page as uint32, then x, y, width, and
+//                 height as int32
+//
+// Records have fixed sizes, so the placement of the rectangle with
+// input index i can be read directly at offset 16 + 8 * P + 20 * i.
+namespace manifest {
+
+
+enum class Format {
+    bin,
+    csv,
+    json,
+};
+
+
+const char magic[4] = {'D', 'P', 'R', 'M'};
+const int version = 1;
+
+
+struct PageSize {
+    int w;
+    int h;
+};
+
+
+// Items may be in any order; they are written by Item::idx, which
+// should be a permutation of [0..items.size()). names are either
+// empty or indexed by Item::idx; they are ignored by bin.
+void save(
+    const char* fileName,
+    Format format,
+    const std::vector<PageSize>& pageSizes,
+    const std::vector<Item>& items,
+    const std::vector<std::string>& names);
+
+
+}
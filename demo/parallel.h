@@ -0,0 +1,33 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+
+// Call fn(i) for every i in [0..n) using up to numJobs threads,
+// including the calling one. Each thread takes the next index from
+// a shared counter, so indices are started in ascending order.
+template<typename Fn>
+void parallelFor(std::size_t n, std::size_t numJobs, const Fn& fn)
+{
+    std::atomic<std::size_t> nextIdx(0);
+    const auto worker = [&]()
+    {
+        std::size_t i;
+        while ((i = nextIdx++) < n)
+            fn(i);
+    };
+
+    numJobs = std::min(numJobs, n);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < numJobs; ++i)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (auto& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,88 @@
+#include "png_io.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <png.h>
+
+
+namespace png_io {
+
+
+static bool beginRead(const char* fileName, png_image& image)
+{
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+
+    if (!png_image_begin_read_from_file(&image, fileName)) {
+        std::fprintf(
+            stderr, "Can't read %s: %s\n", fileName, image.message);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool readSize(const char* fileName, int& w, int& h)
+{
+    png_image image;
+    if (!beginRead(fileName, image))
+        return false;
+
+    w = image.width;
+    h = image.height;
+    png_image_free(&image);
+
+    return true;
+}
+
+
+bool read(const char* fileName, PngImage& result)
+{
+    png_image image;
+    if (!beginRead(fileName, image))
+        return false;
+
+    image.format = PNG_FORMAT_RGBA;
+    result.w = image.width;
+    result.h = image.height;
+    result.pixels.resize(PNG_IMAGE_SIZE(image));
+
+    if (!png_image_finish_read(
+            &image, nullptr, result.pixels.data(), 0, nullptr)) {
+        std::fprintf(
+            stderr, "Can't read %s: %s\n", fileName, image.message);
+        png_image_free(&image);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool write(std::FILE* fp, int w, int h, const std::uint8_t* pixels)
+{
+    assert(fp);
+    assert(w > 0);
+    assert(h > 0);
+
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = w;
+    image.height = h;
+    image.format = PNG_FORMAT_RGBA;
+
+    if (!png_image_write_to_stdio(&image, fp, 0, pixels, 0, nullptr)) {
+        std::fprintf(
+            stderr, "libpng can't write image: %s\n", image.message);
+        return false;
+    }
+
+    return true;
+}
+
+
+}
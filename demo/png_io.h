@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+
+// 8-bit RGBA image.
+struct PngImage {
+    int w;
+    int h;
+    std::vector<std::uint8_t> pixels;
+
+    PngImage()
+        : w(0)
+        , h(0)
+        , pixels()
+    {}
+};
+
+
+namespace png_io {
+
+
+// Read only the header of a PNG file to get the size of the image.
+// Returns false and prints a message if the file can't be read.
+bool readSize(const char* fileName, int& w, int& h);
+
+// Read a PNG file of any color type, converting it to 8-bit RGBA.
+// Returns false and prints a message if the file can't be read.
+bool read(const char* fileName, PngImage& image);
+
+// Write w * h RGBA pixels as a PNG file.
+// Returns false and prints a message on failure.
+bool write(std::FILE* fp, int w, int h, const std::uint8_t* pixels);
+
+
+}
@@ -1,14 +1,190 @@
-
 #include "svg_canvas.h"
 
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <zlib.h>
 
 #include "palette.h"
 
 
-SvgCanvas::SvgCanvas(int w, int h)
+namespace {
+
+
+// Buffered writer that formats integers by hand and optionally
+// streams the output through gzip. The first error is printed, and
+// the following output is discarded; finish() tells whether all
+// output was written.
+class Writer {
+public:
+    Writer(std::FILE* fp, bool compress);
+    ~Writer();
+
+    // Flush the remaining output. Returns false if any of it could
+    // not be written.
+    bool finish();
+
+    void put(const char* str, std::size_t len);
+
+    void put(const char* str)
+    {
+        put(str, std::strlen(str));
+    }
+
+    void put(char c)
+    {
+        if (pos == sizeof(buf))
+            flush(false);
+        buf[pos++] = c;
+    }
+
+    void putInt(int i);
+private:
+    std::FILE* fp;
+    bool compress;
+    z_stream zStream;
+    bool failed;
+
+    char buf[1 << 16];
+    std::size_t pos;
+
+    void flush(bool finish);
+    void writeCompressed(bool finish);
+    void write(const void* data, std::size_t size);
+};
+
+
+Writer::Writer(std::FILE* fp, bool compress)
+    : fp(fp)
+    , compress(compress)
+    , zStream()
+    , failed(false)
+    , pos(0)
+{
+    assert(fp);
+
+    // 16 added to windowBits selects the gzip wrapper.
+    if (compress
+            && deflateInit2(
+                &zStream,
+                Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        std::fprintf(stderr, "zlib can't initialize deflate stream\n");
+        this->compress = false;
+        failed = true;
+    }
+}
+
+
+Writer::~Writer()
+{
+    if (compress)
+        deflateEnd(&zStream);
+}
+
+
+bool Writer::finish()
+{
+    flush(true);
+    return !failed;
+}
+
+
+void Writer::put(const char* str, std::size_t len)
+{
+    while (len > 0) {
+        if (pos == sizeof(buf))
+            flush(false);
+
+        auto n = sizeof(buf) - pos;
+        if (n > len)
+            n = len;
+
+        std::memcpy(buf + pos, str, n);
+        pos += n;
+        str += n;
+        len -= n;
+    }
+}
+
+
+void Writer::putInt(int i)
+{
+    char digits[16];
+    char* end = digits + sizeof(digits);
+    char* p = end;
+
+    // Negate in unsigned to handle INT_MIN.
+    unsigned u = i < 0 ? 0u - static_cast<unsigned>(i) : i;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+
+    if (i < 0)
+        *--p = '-';
+
+    put(p, end - p);
+}
+
+
+void Writer::flush(bool finish)
+{
+    if (failed)
+        ;
+    else if (compress)
+        writeCompressed(finish);
+    else
+        write(buf, pos);
+
+    pos = 0;
+}
+
+
+void Writer::writeCompressed(bool finish)
+{
+    zStream.next_in = reinterpret_cast<Bytef*>(buf);
+    zStream.avail_in = pos;
+
+    unsigned char out[1 << 16];
+    int ret;
+    do {
+        zStream.next_out = out;
+        zStream.avail_out = sizeof(out);
+        ret = deflate(&zStream, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_ERROR) {
+            std::fprintf(stderr, "zlib can't compress SVG\n");
+            failed = true;
+            return;
+        }
+
+        write(out, sizeof(out) - zStream.avail_out);
+        if (failed)
+            return;
+    } while (zStream.avail_out == 0 || (finish && ret != Z_STREAM_END));
+}
+
+
+void Writer::write(const void* data, std::size_t size)
+{
+    if (size > 0 && std::fwrite(data, 1, size, fp) != size) {
+        std::fprintf(stderr, "Can't write SVG: %s\n", std::strerror(errno));
+        failed = true;
+    }
+}
+
+
+}
+
+
+SvgCanvas::SvgCanvas(int w, int h, bool compress)
     : w(w)
     , h(h)
+    , compress(compress)
     , rects()
 {
     assert(w > 0);
@@ -33,26 +209,31 @@ void SvgCanvas::drawRect(const Rect& rect, int rectIdx)
 
 const char* SvgCanvas::getFileExtension() const
 {
-    return ".svg";
+    return compress ? ".svgz" : ".svg";
 }
 
 
-void SvgCanvas::save(std::FILE* fp) const
+static bool hasStroke(const Rect& rect)
 {
-    assert(fp);
+    return rect.w > 1 && rect.h > 1;
+}
+
 
-    std::fputs(
-        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n",
-        fp);
-    std::fprintf(
-        fp,
-        "<svg version=\"1.1\" width=\"%i\" height=\"%i\" "
-        "xmlns=\"http://www.w3.org/2000/svg\">\n",
-        w, h);
+bool SvgCanvas::save(std::FILE* fp) const
+{
+    Writer writer(fp, compress);
+
+    writer.put(
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"no\"?>\n"
+        "<svg version=\"1.1\" width=\"");
+    writer.putInt(w);
+    writer.put("\" height=\"");
+    writer.putInt(h);
+    writer.put("\" xmlns=\"http://www.w3.org/2000/svg\">\n");
 
     // Fill and stoke of the rects are set via CSS to
     // reduce file size.
-    std::fputs("  <style type=\"text/css\"><![CDATA[\n", fp);
+    writer.put("  <style type=\"text/css\"><![CDATA[\n");
     for (int i = 0; i < palette::numColors; ++i) {
         char hexColors[2][8];
         auto color = palette::colors[i];
@@ -63,58 +244,103 @@ void SvgCanvas::save(std::FILE* fp) const
             color = color.adjustBrightness(-0x33);
         }
 
-        std::fprintf(
-            fp, "    rect.s%is {fill: %s; stroke: %s;}\n",
-            i, hexColors[0], hexColors[1]);
-        std::fprintf(
-            fp, "    rect.s%i {fill: %s;}\n",
-            i, hexColors[1]);
+        writer.put("    .s");
+        writer.putInt(i);
+        writer.put("s {fill: ");
+        writer.put(hexColors[0]);
+        writer.put("; stroke: ");
+        writer.put(hexColors[1]);
+        writer.put(";}\n");
+
+        writer.put("    .s");
+        writer.putInt(i);
+        writer.put(" {fill: ");
+        writer.put(hexColors[1]);
+        writer.put(";}\n");
     }
-    std::fputs("  ]]></style>\n", fp);
+    writer.put("  ]]></style>\n");
 
     // White background
-    std::fputs(
+    writer.put(
         "  <rect x=\"0\" y=\"0\" width=\"100%\" height=\"100%\" "
-        "fill=\"white\"/>\n",
-        fp);
-
-    for (const auto& svgRect : rects) {
-        const auto& rect = svgRect.rect;
-        assert(rect.w > 0);
-        assert(rect.h > 0);
-
-        float rectX;
-        float rectY;
-        int rectW;
-        int rectH;
-
-        // In SVG, the center of a stroke is placed on edges of a shape,
-        // so we'll need to reduce the rectangle by half the thickness
-        // of the stroke ("stroke-width" property; defaults to 1).
-        // If the rectangle is not big enough to have the stroke, we'll
-        // draw it without one, but filling with the stroke's color.
-        const bool noStroke = rect.w == 1 || rect.h == 1;
-
-        if (noStroke) {
-            rectX = rect.x;
-            rectY = rect.y;
-            rectW = rect.w;
-            rectH = rect.h;
-        } else {
-            rectX = rect.x + 0.5f;
-            rectY = rect.y + 0.5f;
-            rectW = rect.w - 1;
-            rectH = rect.h - 1;
+        "fill=\"white\"/>\n");
+
+    // All rects of the same class are written as subpaths of a single
+    // path. Rects never overlap, and strokes stay within the bounds
+    // of their rects (see below), so the rendering is the same as
+    // with a separate <rect> for each.
+    //
+    // Rects are bucketed by class in a single pass (a counting sort
+    // of indices), keeping their order within each class.
+    const int numClasses = palette::numColors * 2;
+    const auto getClassIdx = [](const SvgRect& svgRect)
+    {
+        return (
+            svgRect.rectIdx % palette::numColors * 2
+            + hasStroke(svgRect.rect));
+    };
+
+    std::size_t classBegin[numClasses + 1] = {};
+    for (const auto& svgRect : rects)
+        ++classBegin[getClassIdx(svgRect) + 1];
+    for (int i = 0; i < numClasses; ++i)
+        classBegin[i + 1] += classBegin[i];
+
+    assert(rects.size() <= UINT32_MAX);
+    std::vector<std::uint32_t> order(rects.size());
+    {
+        std::size_t classPos[numClasses];
+        std::copy(classBegin, classBegin + numClasses, classPos);
+        for (std::size_t i = 0; i < rects.size(); ++i)
+            order[classPos[getClassIdx(rects[i])]++] = i;
+    }
+
+    for (int classIdx = 0; classIdx < numClasses; ++classIdx) {
+        const int colorIdx = classIdx / 2;
+        const bool stroke = classIdx % 2 != 0;
+
+        for (auto i = classBegin[classIdx];
+                i < classBegin[classIdx + 1]; ++i) {
+            const auto& rect = rects[order[i]].rect;
+            assert(rect.w > 0);
+            assert(rect.h > 0);
+
+            if (i == classBegin[classIdx]) {
+                writer.put("  <path class=\"s");
+                writer.putInt(colorIdx);
+                writer.put(stroke ? "s\" d=\"" : "\" d=\"");
+            } else
+                writer.put("\n    ");
+
+            // In SVG, the center of a stroke is placed on edges
+            // of a shape, so we'll need to reduce the rectangle
+            // by half the thickness of the stroke ("stroke-width"
+            // property; defaults to 1). If the rectangle is not
+            // big enough to have the stroke, we'll draw it without
+            // one, but filling with the stroke's color.
+            const char* frac = stroke ? ".5" : "";
+            const int rectW = stroke ? rect.w - 1 : rect.w;
+            const int rectH = stroke ? rect.h - 1 : rect.h;
+
+            writer.put('M');
+            writer.putInt(rect.x);
+            writer.put(frac);
+            writer.put(' ');
+            writer.putInt(rect.y);
+            writer.put(frac);
+            writer.put('h');
+            writer.putInt(rectW);
+            writer.put('v');
+            writer.putInt(rectH);
+            writer.put('h');
+            writer.putInt(-rectW);
+            writer.put('z');
         }
 
-        std::fprintf(
-            fp,
-            "  <rect x=\"%g\" y=\"%g\" width=\"%i\" height=\"%i\" "
-            "class=\"s%i%s\"/>\n",
-            rectX, rectY, rectW, rectH,
-            svgRect.rectIdx % palette::numColors,
-            noStroke ? "" : "s");
+        if (classBegin[classIdx] < classBegin[classIdx + 1])
+            writer.put("\"/>\n");
     }
 
-    std::fputs("</svg>\n", fp);
+    writer.put("</svg>\n");
+    return writer.finish();
 }
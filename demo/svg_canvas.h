@@ -1,4 +1,3 @@
-
 #pragma once
 
 #include <cstdint>
@@ -9,15 +8,18 @@
 
 class SvgCanvas : public Canvas {
 public:
-    SvgCanvas(int w, int h);
+    // If compress is true, the image is saved as gzip-compressed SVG
+    // (.svgz).
+    SvgCanvas(int w, int h, bool compress = false);
 
     void drawRect(const Rect& rect, int rectIdx) override;
 
     const char* getFileExtension() const override;
-    void save(std::FILE* fp) const override;
+    bool save(std::FILE* fp) const override;
 private:
     int w;
     int h;
+    bool compress;
 
     struct SvgRect {
         Rect rect;
@@ -0,0 +1,124 @@
+#include "trace.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace trace {
+
+
+bool enabled;
+
+
+struct Event {
+    const char* name;
+    char phase;
+    unsigned tid;
+    long long ts;
+    long long dur;
+    std::size_t pageIdx;
+    double value;
+};
+
+
+static std::string outFile;
+static Clock::time_point startTime;
+static std::mutex eventsMutex;
+static std::vector<Event> events;
+static std::atomic<unsigned> nextTid(1);
+
+
+static unsigned getTid()
+{
+    static thread_local unsigned tid = nextTid++;
+    return tid;
+}
+
+
+static long long getUs(Clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        t - startTime).count();
+}
+
+
+static void addEvent(const Event& event)
+{
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    events.push_back(event);
+}
+
+
+static void save()
+{
+    std::FILE* fp = std::fopen(outFile.c_str(), "w");
+    if (!fp) {
+        std::fprintf(
+            stderr,
+            "Can't open %s for writing: %s\n",
+            outFile.c_str(), std::strerror(errno));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(eventsMutex);
+
+    std::fprintf(fp, "{\"traceEvents\": [\n");
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const auto& e = events[i];
+        std::fprintf(
+            fp,
+            "{\"name\": \"%s\", \"ph\": \"%c\", \"pid\": 1, \"tid\": %u, "
+            "\"ts\": %lld",
+            e.name, e.phase, e.tid, e.ts);
+
+        if (e.phase == 'X') {
+            std::fprintf(fp, ", \"dur\": %lld", e.dur);
+            if (e.pageIdx != noPage)
+                std::fprintf(fp, ", \"args\": {\"page\": %zu}", e.pageIdx);
+        } else
+            std::fprintf(
+                fp, ", \"args\": {\"%s\": %.17g}", e.name, e.value);
+
+        std::fprintf(fp, "}%s\n", i + 1 < events.size() ? "," : "");
+    }
+    std::fprintf(fp, "]}\n");
+
+    std::fclose(fp);
+}
+
+
+void start(const char* fileName)
+{
+    if (enabled)
+        return;
+
+    outFile = fileName;
+    startTime = Clock::now();
+    enabled = true;
+    std::atexit(save);
+}
+
+
+void addSpan(
+    const char* name, std::size_t pageIdx,
+    Clock::time_point begin, Clock::time_point end)
+{
+    const auto ts = getUs(begin);
+    addEvent(Event{name, 'X', getTid(), ts, getUs(end) - ts, pageIdx, 0.0});
+}
+
+
+void addCounter(const char* name, double value)
+{
+    addEvent(
+        Event{name, 'C', getTid(), getUs(Clock::now()), 0, noPage, value});
+}
+
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+
+// Timeline of the run in the Trace Event format, which can be opened
+// in chrome://tracing or Perfetto.
+//
+// Spans ("X" events) show phases like loading and rendering of every
+// page on the thread that ran them; counters ("C" events) show values
+// sampled over time. Events are kept in memory and written when the
+// program exits. Until start() is called, spans and counters cost one
+// check of a global flag and never read the clock.
+namespace trace {
+
+
+using Clock = std::chrono::steady_clock;
+
+
+extern bool enabled;
+
+
+// Start recording; events are written to fileName at exit.
+void start(const char* fileName);
+
+
+const std::size_t noPage = static_cast<std::size_t>(-1);
+
+
+// name should be a string literal or otherwise outlive the program.
+void addSpan(
+    const char* name, std::size_t pageIdx,
+    Clock::time_point begin, Clock::time_point end);
+void addCounter(const char* name, double value);
+
+
+inline void counter(const char* name, double value)
+{
+    if (enabled)
+        addCounter(name, value);
+}
+
+
+// Span from construction to destruction of the object. pageIdx,
+// unless noPage, is shown in the arguments of the event.
+class Span {
+public:
+    explicit Span(const char* name, std::size_t pageIdx = noPage)
+        : name(name)
+        , pageIdx(pageIdx)
+        , begin()
+    {
+        if (enabled)
+            begin = Clock::now();
+    }
+
+    ~Span()
+    {
+        if (enabled)
+            addSpan(name, pageIdx, begin, Clock::now());
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+private:
+    const char* name;
+    std::size_t pageIdx;
+    Clock::time_point begin;
+};
+
+
+}
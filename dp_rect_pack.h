@@ -25,10 +25,34 @@
 #ifndef DP_RECT_PACK_H
 #define DP_RECT_PACK_H
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstddef>
+#include <iterator>
+#include <limits>
 #include <vector>
 
+#ifdef DP_RECT_PACK_THREADS
+    #if __cplusplus < 201103L \
+            && !(defined(_MSVC_LANG) && _MSVC_LANG >= 201103L)
+        #error "DP_RECT_PACK_THREADS requires C++11."
+    #endif
+
+    #include <atomic>
+    #include <condition_variable>
+    #include <functional>
+    #include <memory>
+    #include <mutex>
+    #include <thread>
+
+    // The number of nodes insert() checks in the calling thread
+    // before it starts to check the remaining pages concurrently.
+    #ifndef DP_RECT_PACK_PARALLEL_SEARCH_MIN_NODES
+        #define DP_RECT_PACK_PARALLEL_SEARCH_MIN_NODES 16384
+    #endif
+#endif
+
 
 #define DP_RECT_PACK_VERSION_MAJOR 1
 #define DP_RECT_PACK_VERSION_MINOR 1
@@ -65,6 +89,319 @@ struct InsertStatus {
 };
 
 
+/**
+ * How RectPacker chooses a page for a rectangle.
+ *
+ * \sa RectPacker::setPageSelection()
+ */
+struct PageSelection {
+    enum Type {
+        /**
+         * The first page that can hold the rectangle.
+         *
+         * This is the default. Pages are filled well, but all pages
+         * are checked before a new one is added.
+         */
+        firstFit,
+
+        /**
+         * The first of the last N pages that can hold the rectangle.
+         *
+         * Older pages are never checked, so the cost of the search
+         * doesn't grow with the number of pages, but pages are
+         * filled worse than with firstFit. With N = 1, this is the
+         * next-fit strategy.
+         */
+        lastPages,
+
+        /**
+         * The page where the rectangle leaves the least unused space.
+         *
+         * The waste is the area of the free node the rectangle goes
+         * to minus the area of the rectangle, or, if the page has to
+         * grow, the increase of the page area minus the area of the
+         * rectangle. Ties go to the page with the lowest index.
+         * All pages are checked for every rectangle, so this is the
+         * slowest strategy.
+         */
+        bestFit
+    };
+};
+
+
+/**
+ * Counters of page selection.
+ *
+ * \sa RectPacker::getPageSelectionStats()
+ */
+struct PageSelectionStats {
+    std::size_t numRects;  ///< Successfully inserted rectangles
+    std::size_t numPagesChecked;  ///< Pages checked for the rectangles
+
+    /**
+     * Pages added because none of the checked pages could hold
+     * a rectangle.
+     */
+    std::size_t numPagesAdded;
+
+    PageSelectionStats()
+        : numRects(0)
+        , numPagesChecked(0)
+        , numPagesAdded(0)
+    {}
+};
+
+
+/**
+ * Heap memory held by a RectPacker.
+ *
+ * \sa RectPacker::getMemoryUsage(), RectPacker::getPageMemoryUsage()
+ */
+struct MemoryUsage {
+    std::size_t reserved;  ///< Bytes allocated
+    std::size_t used;  ///< Bytes that hold data; <= reserved
+
+    MemoryUsage()
+        : reserved(0)
+        , used(0)
+    {}
+};
+
+
+namespace detail {
+
+
+template<typename T>
+void addMemoryUsage(MemoryUsage& usage, const std::vector<T>& v)
+{
+    usage.reserved += v.capacity() * sizeof(T);
+    usage.used += v.size() * sizeof(T);
+}
+
+
+// Reduce the capacity of the vector to its size. This is
+// std::vector::shrink_to_fit() for C++98.
+template<typename T>
+void shrinkToFit(std::vector<T>& v)
+{
+    if (v.capacity() > v.size())
+        std::vector<T>(v).swap(v);
+}
+
+
+// Type of coordinates of compact nodes. Compact nodes are only
+// used with integer GeomT; for other types, we use GeomT itself,
+// so that the code compiles without conversions from GeomT.
+template<typename GeomT, bool isInteger>
+struct CompactCoord {
+    typedef unsigned short Type;
+
+    static bool canHold(GeomT value)
+    {
+        return value <= std::numeric_limits<Type>::max();
+    }
+};
+
+
+template<typename GeomT>
+struct CompactCoord<GeomT, false> {
+    typedef GeomT Type;
+
+    static bool canHold(GeomT /* value */)
+    {
+        return false;
+    }
+};
+
+
+// Compile-time assertion: only the true specialization is complete,
+// so sizeof(StaticAssert<false>) doesn't compile.
+template<bool condition>
+struct StaticAssert;
+
+
+template<>
+struct StaticAssert<true> {};
+
+
+// Output iterator that discards everything written to it.
+struct DiscardIterator {
+    DiscardIterator& operator*()
+    {
+        return *this;
+    }
+
+    template<typename T>
+    DiscardIterator& operator=(const T& /* value */)
+    {
+        return *this;
+    }
+
+    DiscardIterator& operator++()
+    {
+        return *this;
+    }
+};
+
+
+#ifdef DP_RECT_PACK_THREADS
+
+
+// Persistent pool of threads that run the same job in parallel.
+class ThreadPool {
+public:
+    // numThreads includes the thread that calls run().
+    explicit ThreadPool(std::size_t numThreads)
+        : threads()
+        , mutex()
+        , startCv()
+        , doneCv()
+        , job(nullptr)
+        , generation(0)
+        , numRunning(0)
+        , stop(false)
+    {
+        for (std::size_t i = 1; i < numThreads; ++i)
+            threads.emplace_back(&ThreadPool::work, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        startCv.notify_all();
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Call fn() on all threads of the pool, including the calling
+    // one, and wait for all calls to return.
+    void run(const std::function<void()>& fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            numRunning = threads.size();
+            ++generation;
+        }
+        startCv.notify_all();
+
+        fn();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCv.wait(lock, [this]{ return numRunning == 0; });
+        job = nullptr;
+    }
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable startCv;
+    std::condition_variable doneCv;
+    const std::function<void()>* job;
+    std::size_t generation;
+    std::size_t numRunning;
+    bool stop;
+
+    void work()
+    {
+        std::size_t lastGeneration = 0;
+        for (;;) {
+            const std::function<void()>* fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                startCv.wait(lock, [&]{
+                    return stop || generation != lastGeneration;
+                });
+                if (stop)
+                    return;
+
+                lastGeneration = generation;
+                fn = job;
+            }
+
+            (*fn)();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--numRunning == 0)
+                doneCv.notify_one();
+        }
+    }
+};
+
+
+// Owns a ThreadPool that is created on first use. Copies don't
+// share the pool; they get their own one with the same number of
+// threads.
+class LazyThreadPool {
+public:
+    LazyThreadPool()
+        : numThreads(1)
+        , pool()
+    {}
+
+    LazyThreadPool(const LazyThreadPool& other)
+        : numThreads(other.numThreads)
+        , pool()
+    {}
+
+    LazyThreadPool& operator=(const LazyThreadPool& other)
+    {
+        if (this != &other)
+            setNumThreads(other.numThreads);
+        return *this;
+    }
+
+    std::size_t getNumThreads() const
+    {
+        return numThreads;
+    }
+
+    void setNumThreads(std::size_t newNumThreads)
+    {
+        if (newNumThreads < 1)
+            newNumThreads = 1;
+        if (newNumThreads != numThreads) {
+            numThreads = newNumThreads;
+            pool.reset();
+        }
+    }
+
+    ThreadPool& getPool()
+    {
+        assert(numThreads > 1);
+        if (!pool)
+            pool.reset(new ThreadPool(numThreads));
+        return *pool;
+    }
+private:
+    std::size_t numThreads;
+    std::unique_ptr<ThreadPool> pool;
+};
+
+
+// Return a number unique to the calling thread. Numbers are shared
+// by the whole process and given out in the order in which threads
+// first call the function.
+inline std::size_t getThreadNumber()
+{
+    static std::atomic<std::size_t> nextNumber(0);
+    thread_local const std::size_t number = nextNumber.fetch_add(1);
+    return number;
+}
+
+
+#endif  // DP_RECT_PACK_THREADS
+
+
+}  // namespace detail
+
+
 // A note on the implementation.
 // The current algorithm is absolutely the same as in version 1.0.0,
 // except that we only keep the leaf nodes of the binary tree. This
@@ -173,6 +510,23 @@ public:
          * \sa getPageSize()
          */
         std::size_t pageIndex;
+
+        /**
+         * Whether the insertion ran out of the budget set with
+         * setInsertBudget(), so the rectangle may have been placed
+         * worse than without the budget.
+         */
+        bool budgetExceeded;
+    };
+
+    /**
+     * Region of a page returned by takeDirtyRegions().
+     */
+    struct DirtyRegion {
+        std::size_t pageIndex;
+        Position pos;
+        GeomT width;
+        GeomT height;
     };
 
     /**
@@ -214,6 +568,12 @@ public:
         const Padding& pagePadding = Padding(0))
             : ctx(maxPageWidth, maxPageHeight, rectsSpacing, pagePadding)
             , pages(1)
+            , maxDirtyRegions(0)
+            , dirtyPages()
+            , pageSelection(PageSelection::firstFit)
+            , numLastPages(1)
+            , maxInsertNodes(0)
+            , maxInsertPages(0)
     {}
 
     /**
@@ -242,6 +602,141 @@ public:
         height = size.h;
     }
 
+    /**
+     * Return the number of free nodes of the page.
+     *
+     * Free nodes are the areas of the page where the next rectangles
+     * are searched for; insertion time grows with their number, so
+     * this is mostly useful for profiling.
+     *
+     * \param pageIndex index of the page in range [0..getNumPages())
+     *
+     * \sa getNumPages()
+     */
+    std::size_t getNumFreeNodes(std::size_t pageIndex) const
+    {
+        return pages[pageIndex].getNumNodes(ctx);
+    }
+
+    /**
+     * Mark the page as final.
+     *
+     * insert() will not put rectangles in a final page, and
+     * compact() will free the memory used to search in it. This is
+     * useful for pages that are full enough, or whose images were
+     * already uploaded and should not change.
+     *
+     * Rolling back a transaction doesn't unmark pages.
+     *
+     * \param pageIndex index of the page in range [0..getNumPages())
+     *
+     * \sa isPageFinal()
+     */
+    void setPageFinal(std::size_t pageIndex)
+    {
+        pages[pageIndex].setFinal();
+    }
+
+    /**
+     * Return whether the page was marked with setPageFinal().
+     *
+     * \param pageIndex index of the page in range [0..getNumPages())
+     */
+    bool isPageFinal(std::size_t pageIndex) const
+    {
+        return pages[pageIndex].isFinal();
+    }
+
+    /**
+     * Return the total heap memory held by the packer.
+     *
+     * This includes the memory of all pages (see
+     * getPageMemoryUsage()), as well as the memory of the page list,
+     * dirty region tracking, and the transaction log. Threads of the
+     * parallel page search are not counted.
+     *
+     * Vectors of the packer only grow, so the reserved memory may
+     * be much higher than the used one after a transaction or
+     * takeDirtyRegions(). Call compact() to release the difference.
+     */
+    MemoryUsage getMemoryUsage() const;
+
+    /**
+     * Return heap memory held by the page.
+     *
+     * This is the memory of the free nodes and the dirty regions
+     * of the page.
+     *
+     * \param pageIndex index of the page in range [0..getNumPages())
+     */
+    MemoryUsage getPageMemoryUsage(std::size_t pageIndex) const;
+
+    /**
+     * Release unused memory.
+     *
+     * Reduces the reserved memory of the packer to the used one and
+     * frees the free nodes of pages marked with setPageFinal(),
+     * since they will never be searched again. The layout of further
+     * insertions is not affected.
+     *
+     * compact() can't be called within a transaction.
+     *
+     * \sa getMemoryUsage()
+     */
+    void compact();
+
+    /**
+     * Set how insert() chooses a page for a rectangle.
+     *
+     * The policy only affects the rectangles inserted after this
+     * call. With a single page, all policies give the same result.
+     *
+     * \param policy the policy; the default is
+     *     PageSelection::firstFit
+     * \param newNumLastPages N for PageSelection::lastPages; should
+     *     be > 0
+     *
+     * \sa getPageSelectionStats()
+     */
+    void setPageSelection(
+        PageSelection::Type policy, std::size_t newNumLastPages = 1)
+    {
+        assert(newNumLastPages > 0);
+        pageSelection = policy;
+        numLastPages = newNumLastPages;
+    }
+
+    /**
+     * Return the page selection policy.
+     */
+    PageSelection::Type getPageSelection() const
+    {
+        return pageSelection;
+    }
+
+    /**
+     * Return counters of insertions made with the given policy.
+     *
+     * Every policy has its own counters, so policies can be compared
+     * on the same packer, e.g., to see how many pages were checked
+     * per rectangle. The counters are not restored by
+     * rollbackTransaction().
+     */
+    const PageSelectionStats& getPageSelectionStats(
+        PageSelection::Type policy) const
+    {
+        return pageSelectionStats[policy];
+    }
+
+    /**
+     * Reset counters of all policies to zero.
+     */
+    void resetPageSelectionStats()
+    {
+        for (std::size_t i = 0; i < numPageSelections; ++i)
+            pageSelectionStats[i] = PageSelectionStats();
+    }
+
     /**
      * Insert a rectangle.
      *
@@ -261,60 +756,458 @@ public:
      * \param width width of the rectangle
      * \param height height of the rectangle
      * \returns InsertResult
+     *
+     * \sa insertRepeated()
      */
     InsertResult insert(GeomT width, GeomT height);
-private:
-    struct Size {
-        GeomT w;
-        GeomT h;
-
-        Size(GeomT w, GeomT h)
-            : w(w)
-            , h(h)
-        {}
-    };
 
-    struct Context;
-    class Page {
-    public:
-        Page()
-            : nodes()
-            , rootSize(0, 0)
-            , growDownRootBottomIdx(0)
-        {}
+    /**
+     * Insert count rectangles of the same size.
+     *
+     * The result is exactly the same as of calling insert() count
+     * times, but faster: pages and free nodes that didn't fit the
+     * previous rectangle of the run are not checked again.
+     *
+     * \param width width of the rectangles
+     * \param height height of the rectangles
+     * \param count number of rectangles
+     * \param out output iterator that receives InsertResult for
+     *     every rectangle, in the order of insertion
+     * \returns InsertStatus::ok, or the error that prevents insertion
+     *     of the rectangles; in the latter case, nothing is written
+     *     to out
+     */
+    template<typename OutputIterator>
+    InsertStatus::Type insertRepeated(
+        GeomT width, GeomT height, std::size_t count, OutputIterator out);
 
-        Size getSize(const Context& ctx) const
-        {
-            return Size(
-                ctx.padding.left + rootSize.w + ctx.padding.right,
-                ctx.padding.top + rootSize.h + ctx.padding.bottom);
-        }
+    /**
+     * Check whether a rectangle fits in one of the existing pages.
+     *
+     * The packer is not changed.
+     *
+     * \returns true if insert() would put the rectangle in one of
+     *     the existing pages; false if it would create a new page or
+     *     return an error. Only the pages checked by the current
+     *     page selection policy are considered.
+     */
+    bool canFit(GeomT width, GeomT height) const;
 
-        bool insert(Context& ctx, const Size& rect, Position& pos);
-    private:
-        struct Node {
-            Position pos;
-            Size size;
+    /**
+     * Give all pages the maximum size.
+     *
+     * By default, a page starts empty and grows as rectangles are
+     * inserted, up to the maximum size. With fixed page size, a new
+     * page covers the maximum size from the start, so the growth
+     * heuristics are skipped and getPageSize() returns the maximum
+     * size for every page, which suits layers of a texture array.
+     * Rectangles fill a page in rows from top to bottom: each row is
+     * as high as its first rectangle, and the rest of the page below
+     * it stays in one piece. For rectangles sorted as described in
+     * insert(), that usually takes no more pages than growth, and
+     * often fewer.
+     *
+     * The setting applies to pages that are empty when a rectangle is
+     * inserted; pages that already hold rectangles keep their layout.
+     * Call it before the first insertion to have all pages fixed.
+     * The maximum page size should be finite.
+     *
+     * \sa hasFixedPageSize()
+     */
+    void setFixedPageSize(bool fixedPageSize)
+    {
+        ctx.fixedPageSize = fixedPageSize;
+    }
 
-            Node(GeomT x, GeomT y, GeomT w, GeomT h)
-                : pos(x, y)
-                , size(w, h)
+    /**
+     * Return whether pages have fixed size.
+     *
+     * \sa setFixedPageSize()
+     */
+    bool hasFixedPageSize() const
+    {
+        return ctx.fixedPageSize;
+    }
+
+    /**
+     * Limit the work of a single insertion.
+     *
+     * By default, insert() checks all free nodes of a page before
+     * trying to grow the page, and all pages before adding a new one,
+     * which takes more time as the pages fill up. The budget puts an
+     * upper bound on that time at the cost of density:
+     *     * After maxNodes free nodes were checked, the remaining nodes
+     *       of the pages are skipped, and the pages are only grown.
+     *     * After maxPages pages failed to hold the rectangle,
+     *       a new page is added.
+     *
+     * InsertResult::budgetExceeded tells whether the insertion hit
+     * either limit. insertRepeated() applies the budget to every
+     * rectangle, but nodes checked for the previous rectangles of the
+     * run are not checked again, so its results may differ from the
+     * same number of insert() calls.
+     *
+     * The budget doesn't apply to PageSelection::bestFit, canFit(),
+     * and disables the parallel page search.
+     *
+     * \param maxNodes maximum number of free nodes to check; 0 (the
+     *     default) is unlimited
+     * \param maxPages maximum number of pages to try before adding
+     *     a new one; 0 (the default) is unlimited
+     */
+    void setInsertBudget(std::size_t maxNodes, std::size_t maxPages)
+    {
+        maxInsertNodes = maxNodes;
+        maxInsertPages = maxPages;
+    }
+
+    /**
+     * Declare the minimum size of the rectangles to be inserted.
+     *
+     * Free nodes narrower than width or lower than height can't
+     * hold any of the next rectangles, so the packer drops them
+     * instead of checking them on every insertion. This makes
+     * insertion faster and reduces memory usage without changing
+     * the placement of the rectangles. Existing nodes are dropped
+     * lazily, when a page is checked for the next time.
+     *
+     * The size can be updated as the input goes, e.g., to the
+     * minimum size of the rectangles that are not inserted yet.
+     * Nodes dropped before are not restored if the size decreases.
+     * Inserting a rectangle smaller than the declared size is not
+     * an error, but it may go to a worse place than without the
+     * hint. The default is 0x0, which disables dropping.
+     */
+    void setMinRectSize(GeomT width, GeomT height)
+    {
+        ctx.minRectSize = Size(width, height);
+    }
+
+    /**
+     * Start a transaction.
+     *
+     * Changes made by insert() and insertRepeated() after this call
+     * can be undone with rollbackTransaction(). For example, to
+     * insert a group of rectangles only if all of them fit in the
+     * existing pages, start a transaction, insert the rectangles,
+     * and roll back if getNumPages() has changed.
+     *
+     * Only the changes are recorded, so the cost of a transaction is
+     * proportional to the work done within it rather than to the
+     * size of the packer. Transactions can't be nested.
+     *
+     * \sa commitTransaction(), rollbackTransaction()
+     */
+    void beginTransaction();
+
+    /**
+     * Keep the changes made since beginTransaction() and end the
+     * transaction.
+     */
+    void commitTransaction();
+
+    /**
+     * Undo the changes made since beginTransaction() and end the
+     * transaction.
+     *
+     * Results of all insertions made within the transaction become
+     * invalid.
+     */
+    void rollbackTransaction();
+
+    /**
+     * Return whether a transaction is in progress.
+     */
+    bool isInTransaction() const
+    {
+        return ctx.inTransaction;
+    }
+
+    /**
+     * Enable or disable tracking of dirty regions.
+     *
+     * When enabled, every inserted rectangle marks its region of the
+     * page as dirty, so that you can update only the changed parts
+     * of the page images. To keep the list short, regions of a page
+     * are merged when their number exceeds maxRegionsPerPage; merged
+     * regions may include free space. The tracking is disabled by
+     * default.
+     *
+     * Changing the limit doesn't affect the collected regions until
+     * the next insertion.
+     *
+     * \param maxRegionsPerPage maximum number of regions per page;
+     *     0 disables the tracking
+     *
+     * \sa takeDirtyRegions()
+     */
+    void setMaxDirtyRegions(std::size_t maxRegionsPerPage)
+    {
+        maxDirtyRegions = maxRegionsPerPage;
+    }
+
+    /**
+     * Return regions changed since the previous call.
+     *
+     * Rolling back a transaction doesn't remove regions of the
+     * rectangles inserted within it, which is harmless for updates.
+     *
+     * \param[out] regions dirty regions, grouped by page in order of
+     *     page indices; the previous contents are removed
+     * \param[out] resizedPages indices of pages that were created or
+     *     resized, in ascending order; the previous contents are
+     *     removed. Images of these pages should be resized (see
+     *     getPageSize()) before updating the regions.
+     *
+     * \sa setMaxDirtyRegions()
+     */
+    void takeDirtyRegions(
+        std::vector<DirtyRegion>& regions,
+        std::vector<std::size_t>& resizedPages);
+
+#ifdef DP_RECT_PACK_THREADS
+    /**
+     * Return the number of threads used to search for a page.
+     *
+     * \note Only available if DP_RECT_PACK_THREADS is defined.
+     *
+     * \sa setSearchThreads()
+     */
+    std::size_t getSearchThreads() const
+    {
+        return searchThreads.getNumThreads();
+    }
+
+    /**
+     * Set the number of threads used to search for a page.
+     *
+     * In multipage mode, insert() checks pages one by one until it
+     * finds the first one that can hold the rectangle. When there
+     * are many pages to check, they can be checked concurrently.
+     * The result is always the same as with a single thread: the
+     * rectangle goes to the page with the lowest index.
+     *
+     * Threads are only used when a search takes long enough for
+     * them to pay off, so a small number of pages is always checked
+     * by the calling thread. The threads are created on first use
+     * and kept until the number of threads is changed or the
+     * RectPacker is destroyed. Copies of the RectPacker have their
+     * own threads.
+     *
+     * \note Only available if DP_RECT_PACK_THREADS is defined before
+     *     including the library, which requires C++11.
+     *
+     * \param numThreads number of threads, including the one that
+     *     calls insert(); 0 and 1 disable the parallel search.
+     *     The default is 1.
+     */
+    void setSearchThreads(std::size_t numThreads)
+    {
+        searchThreads.setNumThreads(numThreads);
+    }
+#endif
+private:
+    struct Size {
+        GeomT w;
+        GeomT h;
+
+        Size(GeomT w, GeomT h)
+            : w(w)
+            , h(h)
+        {}
+    };
+
+    typedef detail::CompactCoord<
+        GeomT, std::numeric_limits<GeomT>::is_integer> CompactCoord;
+    typedef typename CompactCoord::Type CompactCoordT;
+
+    struct Context;
+    class Page {
+    public:
+        Page()
+            : nodes()
+            , compactNodes()
+            , rootSize(0, 0)
+            , growDownRootBottomIdx(0)
+            , scanStartIdx(0)
+            , finalized(false)
+            , prunedMinRectSize(0, 0)
+        {}
+
+        Size getSize(const Context& ctx) const
+        {
+            const Size& size = (
+                ctx.fixedPageSize && rootSize.w == 0
+                    ? ctx.maxSize : rootSize);
+            return Size(
+                ctx.padding.left + size.w + ctx.padding.right,
+                ctx.padding.top + size.h + ctx.padding.bottom);
+        }
+
+        // Forget which nodes are known to be too small. Must be called
+        // before insert() if the rect has a different size than in
+        // the previous call.
+        void resetScan()
+        {
+            scanStartIdx = 0;
+        }
+
+        std::size_t getNumNodes(const Context& ctx) const;
+
+        bool insert(Context& ctx, const Size& rect, Position& pos);
+
+        // Check whether insert() would succeed, regardless of
+        // resetScan().
+        bool canInsert(const Context& ctx, const Size& rect) const;
+
+        // Same as canInsert(), and also return the free space
+        // insert() would leave unused. See PageSelection::bestFit.
+        bool canInsert(
+            const Context& ctx, const Size& rect, double& waste) const;
+
+        // A final page rejects all insertions. See
+        // RectPacker::setPageFinal().
+        bool isFinal() const
+        {
+            return finalized;
+        }
+
+        void setFinal()
+        {
+            finalized = true;
+        }
+
+        void addMemoryUsage(const Context& ctx, MemoryUsage& usage) const;
+
+        // Shrink vectors to fit, or free them if the page is final.
+        void compact(const Context& ctx);
+    private:
+        struct Node {
+            Position pos;
+            Size size;
+
+            Node(GeomT x, GeomT y, GeomT w, GeomT h)
+                : pos(x, y)
+                , size(w, h)
+            {}
+        };
+
+    public:
+        // Record of a change made to the packer within a transaction.
+        struct UndoEntry {
+            enum Type {
+                pageAdded,
+                stateChanged,
+                nodeChanged,
+                nodeInserted,
+                nodeErased
+            };
+
+            Type type;
+            std::size_t pageIdx;
+            std::size_t nodeIdx;
+            // Old node for nodeChanged and nodeErased
+            Node node;
+            // Old state for stateChanged
+            Size rootSize;
+            std::size_t growDownRootBottomIdx;
+
+            UndoEntry(Type type, std::size_t pageIdx)
+                : type(type)
+                , pageIdx(pageIdx)
+                , nodeIdx(0)
+                , node(0, 0, 0, 0)
+                , rootSize(0, 0)
+                , growDownRootBottomIdx(0)
             {}
         };
 
-        // Leaf nodes of the binary tree in depth-first order
+        void undo(Context& ctx, const UndoEntry& entry);
+    private:
+        // Node with 16-bit coordinates. If Context::compactNodes is
+        // set, pages store compactNodes instead of nodes, which
+        // reduces both memory usage and the amount of memory
+        // findNode() has to scan.
+        struct CompactNode {
+            CompactCoordT x;
+            CompactCoordT y;
+            CompactCoordT w;
+            CompactCoordT h;
+        };
+
+        // Leaf nodes of the binary tree in depth-first order. Only
+        // one of the vectors is used, depending on
+        // Context::compactNodes. Nodes should only be accessed with
+        // the methods below.
         std::vector<Node> nodes;
+        std::vector<CompactNode> compactNodes;
         Size rootSize;
         // The index of the first leaf bottom node of the new root
         // created in growDown(). See the method for more details.
         std::size_t growDownRootBottomIdx;
+        // All nodes before this index are too small for the rect
+        // of the current run of insert() calls. See resetScan().
+        std::size_t scanStartIdx;
+        bool finalized;
+        // Context::minRectSize of the last pruneNodes() call
+        Size prunedMinRectSize;
+
+        Node getNode(const Context& ctx, std::size_t nodeIdx) const;
+        void setNode(Context& ctx, std::size_t nodeIdx, const Node& node);
+        void insertNode(
+            Context& ctx, std::size_t nodeIdx, const Node& node);
+        void eraseNode(Context& ctx, std::size_t nodeIdx);
+
+        // Record rootSize and growDownRootBottomIdx in the undo log
+        // before changing them.
+        void saveState(Context& ctx) const;
+
+        static CompactNode makeCompactNode(const Node& node);
+
+        // Whether the node is too small for any of the next rects.
+        // See RectPacker::setMinRectSize().
+        static bool isDeadNode(const Context& ctx, const Node& node);
+
+        // Remove dead nodes if Context::minRectSize has changed.
+        //
+        // Only nodes before growDownRootBottomIdx are removed: the
+        // node growDownRootBottomIdx points to and all nodes after it
+        // are kept, so that growDownRootBottomIdx keeps pointing to
+        // the same node as without pruning, and new nodes go to the
+        // same places relative to the remaining ones. In practice,
+        // nearly all dead nodes are before that index.
+        void pruneNodes(Context& ctx);
+
+        // Whether the next pruneNodes() call will remove dead nodes.
+        bool needsPruning(const Context& ctx) const;
+
+        // Turn an empty page into a single free node of the maximum
+        // size. See RectPacker::setFixedPageSize().
+        void initFixedSize(Context& ctx);
 
         bool tryInsert(Context& ctx, const Size& rect, Position& pos);
         bool findNode(
-            const Size& rect,
+            const Context& ctx, const Size& rect,
+            std::size_t startIdx, std::size_t endIdx,
+            std::size_t& nodeIdx, Position& pos) const;
+        // Same as findNode() for all nodes, but skip the nodes that
+        // insert() will remove with pruneNodes(), so that
+        // canInsert() agrees with insert().
+        bool findLiveNode(
+            const Context& ctx, const Size& rect,
             std::size_t& nodeIdx, Position& pos) const;
         void subdivideNode(
             Context& ctx, std::size_t nodeIdx, const Size& rect);
+        struct Growth {
+            enum Type {
+                none,
+                down,
+                right
+            };
+        };
+
+        typename Growth::Type getGrowth(
+            const Context& ctx, const Size& rect) const;
         bool tryGrow(Context& ctx, const Size& rect, Position& pos);
         void growDown(Context& ctx, const Size& rect, Position& pos);
         void growRight(Context& ctx, const Size& rect, Position& pos);
@@ -324,6 +1217,34 @@ private:
         Size maxSize;
         Spacing spacing;
         Padding padding;
+        // Whether pages store nodes as Page::CompactNode. This is
+        // possible if GeomT is an integer and all coordinates within
+        // a page fit in 16 bits.
+        bool compactNodes;
+
+        // See RectPacker::setFixedPageSize()
+        bool fixedPageSize;
+
+        // See RectPacker::setMinRectSize()
+        Size minRectSize;
+
+        // The number of free nodes the current insertion can still
+        // check, and whether it ran out of them.
+        // See RectPacker::setInsertBudget().
+        std::size_t nodeBudget;
+        bool nodeBudgetExceeded;
+
+        // Changes made within the current transaction. undoPageIdx
+        // is the index of the page that Page methods change.
+        bool inTransaction;
+        std::size_t undoPageIdx;
+        std::vector<typename Page::UndoEntry> undoLog;
+
+        void addUndoEntry(const typename Page::UndoEntry& entry)
+        {
+            if (inTransaction)
+                undoLog.push_back(entry);
+        }
 
         Context(
             GeomT maxPageWidth, GeomT maxPageHeight,
@@ -334,337 +1255,2547 @@ private:
 
     Context ctx;
     std::vector<Page> pages;
-};
 
+    struct DirtyPage {
+        // Size of the page reported by the last takeDirtyRegions()
+        Size size;
+        bool resized;
+        std::vector<DirtyRegion> regions;
 
-template<typename GeomT>
-typename RectPacker<GeomT>::InsertResult
-RectPacker<GeomT>::insert(GeomT width, GeomT height)
-{
-    InsertResult result;
+        DirtyPage()
+            : size(0, 0)
+            , resized(false)
+            , regions()
+        {}
+    };
 
-    if (width < 0 || height < 0) {
-        result.status = InsertStatus::negativeSize;
-        return result;
-    }
+    std::size_t maxDirtyRegions;
+    std::vector<DirtyPage> dirtyPages;
 
-    if (width == 0 || height == 0) {
-        result.status = InsertStatus::zeroSize;
-        return result;
-    }
+    static const std::size_t numPageSelections = 3;
+    PageSelection::Type pageSelection;
+    std::size_t numLastPages;
+    PageSelectionStats pageSelectionStats[numPageSelections];
 
-    if (width > ctx.maxSize.w || height > ctx.maxSize.h) {
-        result.status = InsertStatus::rectTooBig;
-        return result;
+    // See setInsertBudget()
+    std::size_t maxInsertNodes;
+    std::size_t maxInsertPages;
+
+    // Return the first page checked by PageSelection::lastPages.
+    std::size_t getLastPagesBegin() const
+    {
+        return (
+            pages.size() > numLastPages ? pages.size() - numLastPages : 0);
     }
 
-    const Size rect(width, height);
+    // Return the page for PageSelection::bestFit, or pages.size() if
+    // no page can hold the rect.
+    std::size_t findBestPage(const Size& rect, PageSelectionStats& stats);
 
-    for (std::size_t i = 0; i < pages.size(); ++i)
-        if (pages[i].insert(ctx, rect, result.pos)) {
-            result.status = InsertStatus::ok;
-            result.pageIndex = i;
-            return result;
-        }
+    void addPage();
+    void addDirtyRegion(
+        std::size_t pageIdx, const Position& pos, const Size& rect);
+
+#ifdef DP_RECT_PACK_THREADS
+    detail::LazyThreadPool searchThreads;
+
+    std::size_t findPageParallel(std::size_t beginIdx, const Size& rect);
+#endif
+};
 
-    pages.push_back(Page());
-    Page& page = pages.back();
-    page.insert(ctx, rect, result.pos);
-    result.status = InsertStatus::ok;
-    result.pageIndex = pages.size() - 1;
 
+template<typename GeomT>
+typename RectPacker<GeomT>::InsertResult
+RectPacker<GeomT>::insert(GeomT width, GeomT height)
+{
+    InsertResult result;
+    result.status = insertRepeated(width, height, 1, &result);
     return result;
 }
 
 
 template<typename GeomT>
-bool RectPacker<GeomT>::Page::insert(
-    Context& ctx, const Size& rect, Position& pos)
+template<typename OutputIterator>
+InsertStatus::Type RectPacker<GeomT>::insertRepeated(
+    GeomT width, GeomT height, std::size_t count, OutputIterator out)
 {
-    assert(rect.w > 0);
-    assert(rect.w <= ctx.maxSize.w);
-    assert(rect.h > 0);
-    assert(rect.h <= ctx.maxSize.h);
+    if (width < 0 || height < 0)
+        return InsertStatus::negativeSize;
 
-    // The first insertion should be handled especially since
-    // growRight() and growDown() add spacing between the root
-    // and the inserted rectangle.
-    if (rootSize.w == 0) {
-        rootSize = rect;
-        pos.x = ctx.padding.left;
-        pos.y = ctx.padding.top;
+    if (width == 0 || height == 0)
+        return InsertStatus::zeroSize;
 
-        return true;
+    if (width > ctx.maxSize.w || height > ctx.maxSize.h)
+        return InsertStatus::rectTooBig;
+
+    const Size rect(width, height);
+
+    InsertResult result;
+    result.status = InsertStatus::ok;
+    result.pageIndex = 0;
+
+    if (count > 0) {
+        pages[0].resetScan();
+        ctx.undoPageIdx = 0;
     }
 
-    return tryInsert(ctx, rect, pos) || tryGrow(ctx, rect, pos);
-}
+    PageSelectionStats& stats = pageSelectionStats[pageSelection];
+
+    // A page that can't hold the rect will not be able to hold the
+    // next one of the same size, so we never go back to it.
+    for (; count > 0; --count) {
+        ctx.nodeBudget = (
+            maxInsertNodes > 0 && pageSelection != PageSelection::bestFit
+                ? maxInsertNodes : std::numeric_limits<std::size_t>::max());
+        ctx.nodeBudgetExceeded = false;
+        result.budgetExceeded = false;
+
+        if (pageSelection == PageSelection::bestFit) {
+            result.pageIndex = findBestPage(rect, stats);
+            if (result.pageIndex == pages.size()) {
+                addPage();
+                ++stats.numPagesAdded;
+            }
+
+            pages[result.pageIndex].resetScan();
+            ctx.undoPageIdx = result.pageIndex;
+
+            // canInsert() matches insert(), so this is only a safety
+            // net: a new page always accepts the rect.
+            while (!pages[result.pageIndex].insert(
+                    ctx, rect, result.pos)) {
+                result.pageIndex = pages.size();
+                addPage();
+                ++stats.numPagesAdded;
+                ctx.undoPageIdx = result.pageIndex;
+            }
+        } else {
+            if (pageSelection == PageSelection::lastPages
+                    && result.pageIndex < getLastPagesBegin()) {
+                result.pageIndex = getLastPagesBegin();
+                pages[result.pageIndex].resetScan();
+                ctx.undoPageIdx = result.pageIndex;
+            }
+
+            #ifdef DP_RECT_PACK_THREADS
+            std::size_t numCheckedNodes = 0;
+            #endif
+            std::size_t numTriedPages = 0;
+
+            while (!pages[result.pageIndex].insert(
+                    ctx, rect, result.pos)) {
+                ++stats.numPagesChecked;
+                ++numTriedPages;
+
+                #ifdef DP_RECT_PACK_THREADS
+                numCheckedNodes += pages[result.pageIndex].getNumNodes(ctx);
+                if (maxInsertNodes == 0
+                        && maxInsertPages == 0
+                        && searchThreads.getNumThreads() > 1
+                        && (numCheckedNodes
+                            >= DP_RECT_PACK_PARALLEL_SEARCH_MIN_NODES)
+                        && pages.size() - result.pageIndex > 2) {
+                    const std::size_t beginIdx = result.pageIndex + 1;
+                    result.pageIndex = findPageParallel(beginIdx, rect);
+                    stats.numPagesChecked += result.pageIndex - beginIdx;
+                    numCheckedNodes = 0;
+                } else
+                    ++result.pageIndex;
+                #else
+                ++result.pageIndex;
+                #endif
+
+                // Skip the remaining pages if we tried enough.
+                if (maxInsertPages > 0
+                        && numTriedPages >= maxInsertPages
+                        && result.pageIndex < pages.size()) {
+                    result.pageIndex = pages.size();
+                    result.budgetExceeded = true;
+                }
+
+                if (result.pageIndex == pages.size()) {
+                    addPage();
+                    ++stats.numPagesAdded;
+                } else
+                    pages[result.pageIndex].resetScan();
+
+                ctx.undoPageIdx = result.pageIndex;
+            }
+
+            ++stats.numPagesChecked;
+
+            if (ctx.nodeBudgetExceeded)
+                result.budgetExceeded = true;
+        }
 
+        ++stats.numRects;
 
-template<typename GeomT>
-bool RectPacker<GeomT>::Page::tryInsert(
-    Context& ctx, const Size& rect, Position& pos)
-{
-    std::size_t nodeIdx;
-    if (findNode(rect, nodeIdx, pos)) {
-        subdivideNode(ctx, nodeIdx, rect);
-        return true;
+        if (maxDirtyRegions > 0)
+            addDirtyRegion(result.pageIndex, result.pos, rect);
+
+        *out = result;
+        ++out;
     }
 
-    return false;
+    return InsertStatus::ok;
 }
 
 
 template<typename GeomT>
-bool RectPacker<GeomT>::Page::findNode(
-    const Size& rect, std::size_t& nodeIdx, Position& pos) const
+bool RectPacker<GeomT>::canFit(GeomT width, GeomT height) const
 {
-    for (nodeIdx = 0; nodeIdx < nodes.size(); ++nodeIdx) {
-        const Node& node = nodes[nodeIdx];
-        if (rect.w <= node.size.w && rect.h <= node.size.h) {
-            pos = node.pos;
+    if (!(width > 0 && height > 0)
+            || width > ctx.maxSize.w
+            || height > ctx.maxSize.h)
+        return false;
+
+    const Size rect(width, height);
+    const std::size_t beginIdx = (
+        pageSelection == PageSelection::lastPages
+            ? getLastPagesBegin() : 0);
+    for (std::size_t i = beginIdx; i < pages.size(); ++i)
+        if (pages[i].canInsert(ctx, rect))
             return true;
-        }
-    }
 
     return false;
 }
 
 
-/**
- * Called after a rectangle was inserted in the top left corner of
- * a free node to create child nodes from free space, if any.
- *
- * The node is first cut horizontally along the rect's bottom,
- * then vertically along the right edge of the rect. Splitting
- * that way is crucial for the algorithm to work correctly.
- *
- *      +---+
- *      |   |
- *  +---+---+
- *  |       |
- *  +-------+
- */
 template<typename GeomT>
-void RectPacker<GeomT>::Page::subdivideNode(
-    Context& ctx, std::size_t nodeIdx, const Size& rect)
+MemoryUsage RectPacker<GeomT>::getMemoryUsage() const
 {
-    assert(nodeIdx < nodes.size());
+    MemoryUsage usage;
 
-    Node& node = nodes[nodeIdx];
+    detail::addMemoryUsage(usage, pages);
+    for (std::size_t i = 0; i < pages.size(); ++i)
+        pages[i].addMemoryUsage(ctx, usage);
 
-    assert(node.size.w >= rect.w);
-    const GeomT rightW = node.size.w - rect.w;
-    const bool hasSpaceRight = rightW > ctx.spacing.x;
+    detail::addMemoryUsage(usage, dirtyPages);
+    for (std::size_t i = 0; i < dirtyPages.size(); ++i)
+        detail::addMemoryUsage(usage, dirtyPages[i].regions);
 
-    assert(node.size.h >= rect.h);
-    const GeomT bottomH = node.size.h - rect.h;
-    const bool hasSpaceBelow = bottomH > ctx.spacing.y;
+    detail::addMemoryUsage(usage, ctx.undoLog);
 
-    if (hasSpaceRight) {
-        // Right node replaces the current
+    return usage;
+}
 
-        const GeomT bottomX = node.pos.x;
-        const GeomT bottomW = node.size.w;
 
-        node.pos.x += rect.w + ctx.spacing.x;
-        node.size.w = rightW - ctx.spacing.x;
-        node.size.h = rect.h;
+template<typename GeomT>
+MemoryUsage RectPacker<GeomT>::getPageMemoryUsage(
+    std::size_t pageIndex) const
+{
+    MemoryUsage usage;
 
-        if (hasSpaceBelow) {
-            nodes.insert(
-                nodes.begin() + nodeIdx + 1,
-                Node(
-                    bottomX,
-                    node.pos.y + rect.h + ctx.spacing.y,
-                    bottomW,
-                    bottomH - ctx.spacing.y));
+    pages[pageIndex].addMemoryUsage(ctx, usage);
+    if (pageIndex < dirtyPages.size())
+        detail::addMemoryUsage(usage, dirtyPages[pageIndex].regions);
 
-            if (nodeIdx <= growDownRootBottomIdx)
-                ++growDownRootBottomIdx;
-        }
-    } else if (hasSpaceBelow) {
-        // Bottom node replaces the current
-        node.pos.y += rect.h + ctx.spacing.y;
-        node.size.h = bottomH - ctx.spacing.y;
-    } else {
-        nodes.erase(nodes.begin() + nodeIdx);
-        if (nodeIdx < growDownRootBottomIdx)
-            --growDownRootBottomIdx;
-    }
+    return usage;
 }
 
 
 template<typename GeomT>
-bool RectPacker<GeomT>::Page::tryGrow(
-    Context& ctx, const Size& rect, Position& pos)
+void RectPacker<GeomT>::compact()
 {
-    assert(ctx.maxSize.w >= rootSize.w);
-    const GeomT freeW = ctx.maxSize.w - rootSize.w;
-    assert(ctx.maxSize.h >= rootSize.h);
-    const GeomT freeH = ctx.maxSize.h - rootSize.h;
-
-    const bool canGrowDown = (
-        freeH >= rect.h && freeH - rect.h >= ctx.spacing.y);
-    const bool mustGrowDown = (
-        canGrowDown
-        && freeW >= ctx.spacing.x
-        && (rootSize.w + ctx.spacing.x
-            >= rootSize.h + rect.h + ctx.spacing.y));
-    if (mustGrowDown) {
-        growDown(ctx, rect, pos);
-        return true;
-    }
+    assert(!ctx.inTransaction);
 
-    const bool canGrowRight = (
-        freeW >= rect.w && freeW - rect.w >= ctx.spacing.x);
-    if (canGrowRight) {
-        growRight(ctx, rect, pos);
-        return true;
-    }
+    // Copying shrinks the nodes of every page, so compact pages
+    // after that to avoid copying them twice.
+    detail::shrinkToFit(pages);
+    for (std::size_t i = 0; i < pages.size(); ++i)
+        pages[i].compact(ctx);
 
-    if (canGrowDown) {
-        growDown(ctx, rect, pos);
-        return true;
-    }
+    detail::shrinkToFit(dirtyPages);
+    for (std::size_t i = 0; i < dirtyPages.size(); ++i)
+        detail::shrinkToFit(dirtyPages[i].regions);
 
-    return false;
+    std::vector<typename Page::UndoEntry>().swap(ctx.undoLog);
 }
 
 
 template<typename GeomT>
-void RectPacker<GeomT>::Page::growDown(
-    Context& ctx, const Size& rect, Position& pos)
+void RectPacker<GeomT>::beginTransaction()
 {
-    assert(ctx.maxSize.h > rootSize.h);
-    assert(ctx.maxSize.h - rootSize.h >= rect.h);
-    assert(ctx.maxSize.h - rootSize.h - rect.h >= ctx.spacing.y);
+    assert(!ctx.inTransaction);
+    ctx.inTransaction = true;
+    ctx.undoLog.clear();
+}
 
-    pos.x = ctx.padding.left;
-    pos.y = ctx.padding.top + rootSize.h + ctx.spacing.y;
 
-    if (rootSize.w < rect.w) {
-        if (rect.w - rootSize.w > ctx.spacing.x) {
-            // The auxiliary node becomes the right child of the new
-            // root. It contains the current root (bottom child) and
-            // free space at the current root's right (right child).
-            nodes.insert(
-                nodes.begin(),
-                Node(
-                    ctx.padding.left + rootSize.w + ctx.spacing.x,
-                    ctx.padding.top,
-                    rect.w - rootSize.w - ctx.spacing.x,
-                    rootSize.h));
-            ++growDownRootBottomIdx;
+template<typename GeomT>
+void RectPacker<GeomT>::commitTransaction()
+{
+    assert(ctx.inTransaction);
+    ctx.inTransaction = false;
+    ctx.undoLog.clear();
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::rollbackTransaction()
+{
+    assert(ctx.inTransaction);
+    // Undoing must not be recorded.
+    ctx.inTransaction = false;
+
+    for (std::size_t i = ctx.undoLog.size(); i-- > 0;) {
+        const typename Page::UndoEntry& entry = ctx.undoLog[i];
+        if (entry.type == Page::UndoEntry::pageAdded) {
+            assert(entry.pageIdx == pages.size() - 1);
+            pages.pop_back();
+        } else
+            pages[entry.pageIdx].undo(ctx, entry);
+    }
+
+    ctx.undoLog.clear();
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::takeDirtyRegions(
+    std::vector<DirtyRegion>& regions,
+    std::vector<std::size_t>& resizedPages)
+{
+    regions.clear();
+    resizedPages.clear();
+
+    // Pages removed by rollbackTransaction() may still be here.
+    if (dirtyPages.size() > pages.size())
+        dirtyPages.resize(pages.size());
+
+    for (std::size_t i = 0; i < dirtyPages.size(); ++i) {
+        DirtyPage& dirtyPage = dirtyPages[i];
+
+        if (dirtyPage.resized)
+            resizedPages.push_back(i);
+        dirtyPage.resized = false;
+
+        regions.insert(
+            regions.end(),
+            dirtyPage.regions.begin(), dirtyPage.regions.end());
+        dirtyPage.regions.clear();
+    }
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::addDirtyRegion(
+    std::size_t pageIdx, const Position& pos, const Size& rect)
+{
+    if (pageIdx >= dirtyPages.size())
+        dirtyPages.resize(pageIdx + 1);
+
+    DirtyPage& dirtyPage = dirtyPages[pageIdx];
+
+    const Size pageSize = pages[pageIdx].getSize(ctx);
+    if (pageSize.w != dirtyPage.size.w || pageSize.h != dirtyPage.size.h) {
+        dirtyPage.size = pageSize;
+        dirtyPage.resized = true;
+    }
+
+    DirtyRegion region;
+    region.pageIndex = pageIdx;
+    region.pos = pos;
+    region.width = rect.w;
+    region.height = rect.h;
+
+    std::vector<DirtyRegion>& regions = dirtyPage.regions;
+    if (regions.size() < maxDirtyRegions) {
+        regions.push_back(region);
+        return;
+    }
+
+    // Merge the new region with the one that grows the least in area.
+    // Sorted input tends to fill pages row by row, so the last region
+    // is usually the best one and is checked first.
+    std::size_t bestIdx = regions.size();
+    double bestGrowth = 0;
+    for (std::size_t i = regions.size(); i-- > 0;) {
+        const DirtyRegion& other = regions[i];
+
+        const GeomT x1 = other.pos.x < pos.x ? other.pos.x : pos.x;
+        const GeomT y1 = other.pos.y < pos.y ? other.pos.y : pos.y;
+        const GeomT x2 = (
+            other.pos.x + other.width > pos.x + rect.w
+            ? other.pos.x + other.width : pos.x + rect.w);
+        const GeomT y2 = (
+            other.pos.y + other.height > pos.y + rect.h
+            ? other.pos.y + other.height : pos.y + rect.h);
+
+        const double growth = (
+            static_cast<double>(x2 - x1) * static_cast<double>(y2 - y1)
+            - static_cast<double>(other.width)
+                * static_cast<double>(other.height));
+        if (bestIdx == regions.size() || growth < bestGrowth) {
+            bestIdx = i;
+            bestGrowth = growth;
         }
+    }
 
-        rootSize.w = rect.w;
-    } else if (rootSize.w - rect.w > ctx.spacing.x) {
-        // Free space at the right of the inserted rect becomes the
-        // right child of the rect's node, which in turn is the
-        // bottom child of the new root.
-        nodes.insert(
-            nodes.begin() + growDownRootBottomIdx,
-            Node(
-                pos.x + rect.w + ctx.spacing.x,
-                pos.y,
-                rootSize.w - rect.w - ctx.spacing.x,
-                rect.h));
+    DirtyRegion& best = regions[bestIdx];
+    const GeomT x2 = (
+        best.pos.x + best.width > pos.x + rect.w
+        ? best.pos.x + best.width : pos.x + rect.w);
+    const GeomT y2 = (
+        best.pos.y + best.height > pos.y + rect.h
+        ? best.pos.y + best.height : pos.y + rect.h);
+    if (pos.x < best.pos.x)
+        best.pos.x = pos.x;
+    if (pos.y < best.pos.y)
+        best.pos.y = pos.y;
+    best.width = x2 - best.pos.x;
+    best.height = y2 - best.pos.y;
+}
 
-        // The inserted node is visited before the node from the next
-        // growDown() since the current new root will be the right
-        // child of the next root.
-        ++growDownRootBottomIdx;
+
+template<typename GeomT>
+std::size_t RectPacker<GeomT>::findBestPage(
+    const Size& rect, PageSelectionStats& stats)
+{
+    std::size_t bestIdx = pages.size();
+    double bestWaste = 0;
+
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        ++stats.numPagesChecked;
+
+        double waste;
+        if (!pages[i].canInsert(ctx, rect, waste)
+                || (bestIdx < pages.size() && waste >= bestWaste))
+            continue;
+
+        bestIdx = i;
+        bestWaste = waste;
+        if (waste == 0)
+            break;
     }
 
-    rootSize.h += ctx.spacing.y + rect.h;
+    return bestIdx;
 }
 
 
 template<typename GeomT>
-void RectPacker<GeomT>::Page::growRight(
+void RectPacker<GeomT>::addPage()
+{
+    pages.push_back(Page());
+    ctx.addUndoEntry(
+        typename Page::UndoEntry(
+            Page::UndoEntry::pageAdded, pages.size() - 1));
+}
+
+
+#ifdef DP_RECT_PACK_THREADS
+
+
+template<typename GeomT>
+std::size_t RectPacker<GeomT>::findPageParallel(
+    std::size_t beginIdx, const Size& rect)
+{
+    const std::size_t endIdx = pages.size();
+
+    // Threads take pages in ascending order, so once a page that
+    // can hold the rect is found, all pages before it are either
+    // checked or being checked.
+    std::atomic<std::size_t> nextIdx(beginIdx);
+    std::atomic<std::size_t> foundIdx(endIdx);
+
+    searchThreads.getPool().run([&]{
+        for (;;) {
+            const std::size_t pageIdx = nextIdx.fetch_add(1);
+            if (pageIdx >= foundIdx.load())
+                break;
+
+            if (!pages[pageIdx].canInsert(ctx, rect))
+                continue;
+
+            std::size_t curFoundIdx = foundIdx.load();
+            while (pageIdx < curFoundIdx
+                    && !foundIdx.compare_exchange_weak(
+                        curFoundIdx, pageIdx))
+                ;
+            break;
+        }
+    });
+
+    return foundIdx.load();
+}
+
+
+#endif  // DP_RECT_PACK_THREADS
+
+
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::insert(
     Context& ctx, const Size& rect, Position& pos)
 {
-    assert(ctx.maxSize.w > rootSize.w);
-    assert(ctx.maxSize.w - rootSize.w >= rect.w);
-    assert(ctx.maxSize.w - rootSize.w - rect.w >= ctx.spacing.x);
+    assert(rect.w > 0);
+    assert(rect.w <= ctx.maxSize.w);
+    assert(rect.h > 0);
+    assert(rect.h <= ctx.maxSize.h);
 
-    pos.x = ctx.padding.left + rootSize.w + ctx.spacing.x;
-    pos.y = ctx.padding.top;
+    if (finalized)
+        return false;
 
-    if (rootSize.h < rect.h) {
-        if (rect.h - rootSize.h > ctx.spacing.y)
-            // The auxiliary node becomes the bottom child of the
-            // new root. It contains the current root (right child)
-            // and free space at the current root's bottom, if any
-            // (bottom child).
-            nodes.insert(
-                nodes.end(),
-                Node(
-                    ctx.padding.left,
-                    ctx.padding.top + rootSize.h + ctx.spacing.y,
-                    rootSize.w,
-                    rect.h - rootSize.h - ctx.spacing.y));
+    pruneNodes(ctx);
 
-        rootSize.h = rect.h;
-    } else if (rootSize.h - rect.h > ctx.spacing.y) {
-        // Free space at the bottom of the inserted rect becomes the
-        // bottom child of the rect's node, which in turn is the
-        // right child of the new root node.
-        nodes.insert(
-            nodes.begin(),
-            Node(
-                pos.x,
-                pos.y + rect.h + ctx.spacing.y,
-                rect.w,
-                rootSize.h - rect.h - ctx.spacing.y));
-        ++growDownRootBottomIdx;
+    // A fixed page has no growth to fall back to, so the first rect
+    // goes to the only node directly rather than through tryInsert(),
+    // which may skip it due to the insert budget.
+    if (rootSize.w == 0 && ctx.fixedPageSize) {
+        initFixedSize(ctx);
+        pos.x = ctx.padding.left;
+        pos.y = ctx.padding.top;
+        subdivideNode(ctx, 0, rect);
+
+        return true;
     }
 
-    rootSize.w += ctx.spacing.x + rect.w;
+    // The first insertion should be handled especially since
+    // growRight() and growDown() add spacing between the root
+    // and the inserted rectangle.
+    if (rootSize.w == 0) {
+        saveState(ctx);
+        rootSize = rect;
+        pos.x = ctx.padding.left;
+        pos.y = ctx.padding.top;
+
+        return true;
+    }
+
+    return tryInsert(ctx, rect, pos) || tryGrow(ctx, rect, pos);
 }
 
 
 template<typename GeomT>
-RectPacker<GeomT>::Context::Context(
-    GeomT maxPageWidth, GeomT maxPageHeight,
-    const Spacing& rectsSpacing, const Padding& pagePadding)
-        : maxSize(maxPageWidth, maxPageHeight)
-        , spacing(rectsSpacing)
-        , padding(pagePadding)
+bool RectPacker<GeomT>::Page::canInsert(
+    const Context& ctx, const Size& rect) const
 {
-    if (maxSize.w < 0)
-        maxSize.w = 0;
-    if (maxSize.h < 0)
-        maxSize.h = 0;
+    if (finalized)
+        return false;
 
-    if (spacing.x < 0)
-        spacing.x = 0;
-    if (spacing.y < 0)
-        spacing.y = 0;
+    if (rootSize.w == 0)
+        return true;
 
-    subtractPadding(padding.top, maxSize.h);
-    subtractPadding(padding.bottom, maxSize.h);
-    subtractPadding(padding.left, maxSize.w);
-    subtractPadding(padding.right, maxSize.w);
+    std::size_t nodeIdx;
+    Position pos;
+    return (
+        findLiveNode(ctx, rect, nodeIdx, pos)
+        || getGrowth(ctx, rect) != Growth::none);
 }
 
 
 template<typename GeomT>
-void RectPacker<GeomT>::Context::subtractPadding(
-    GeomT& padding, GeomT& size)
+bool RectPacker<GeomT>::Page::canInsert(
+    const Context& ctx, const Size& rect, double& waste) const
 {
-    if (padding < 0)
-        padding = 0;
-    else if (padding < size)
-        size -= padding;
-    else {
-        padding = size;
-        size = 0;
+    if (finalized)
+        return false;
+
+    const double rectArea = static_cast<double>(rect.w) * rect.h;
+
+    if (rootSize.w == 0) {
+        // An empty page of fixed size is the worst choice rather
+        // than the best, as it will never shrink.
+        waste = (
+            ctx.fixedPageSize
+                ? static_cast<double>(ctx.maxSize.w) * ctx.maxSize.h
+                    - rectArea
+                : 0);
+        return true;
+    }
+
+    std::size_t nodeIdx;
+    Position pos;
+    if (findLiveNode(ctx, rect, nodeIdx, pos)) {
+        const Node node = getNode(ctx, nodeIdx);
+        waste = static_cast<double>(node.size.w) * node.size.h - rectArea;
+        return true;
+    }
+
+    Size newRootSize = rootSize;
+    switch (getGrowth(ctx, rect)) {
+        case Growth::none:
+            return false;
+        case Growth::down:
+            newRootSize.w = std::max(rootSize.w, rect.w);
+            newRootSize.h += ctx.spacing.y + rect.h;
+            break;
+        case Growth::right:
+            newRootSize.w += ctx.spacing.x + rect.w;
+            newRootSize.h = std::max(rootSize.h, rect.h);
+            break;
+    }
+
+    waste = (
+        static_cast<double>(newRootSize.w) * newRootSize.h
+        - static_cast<double>(rootSize.w) * rootSize.h
+        - rectArea);
+    return true;
+}
+
+
+template<typename GeomT>
+std::size_t RectPacker<GeomT>::Page::getNumNodes(
+    const Context& ctx) const
+{
+    return ctx.compactNodes ? compactNodes.size() : nodes.size();
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::addMemoryUsage(
+    const Context& ctx, MemoryUsage& usage) const
+{
+    if (ctx.compactNodes)
+        detail::addMemoryUsage(usage, compactNodes);
+    else
+        detail::addMemoryUsage(usage, nodes);
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::compact(const Context& ctx)
+{
+    if (finalized) {
+        std::vector<Node>().swap(nodes);
+        std::vector<CompactNode>().swap(compactNodes);
+        scanStartIdx = 0;
+    } else if (ctx.compactNodes)
+        detail::shrinkToFit(compactNodes);
+    else
+        detail::shrinkToFit(nodes);
+}
+
+
+template<typename GeomT>
+typename RectPacker<GeomT>::Page::Node
+RectPacker<GeomT>::Page::getNode(
+    const Context& ctx, std::size_t nodeIdx) const
+{
+    if (!ctx.compactNodes)
+        return nodes[nodeIdx];
+
+    const CompactNode& node = compactNodes[nodeIdx];
+    return Node(node.x, node.y, node.w, node.h);
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::setNode(
+    Context& ctx, std::size_t nodeIdx, const Node& node)
+{
+    if (ctx.inTransaction) {
+        UndoEntry entry(UndoEntry::nodeChanged, ctx.undoPageIdx);
+        entry.nodeIdx = nodeIdx;
+        entry.node = getNode(ctx, nodeIdx);
+        ctx.addUndoEntry(entry);
+    }
+
+    if (ctx.compactNodes)
+        compactNodes[nodeIdx] = makeCompactNode(node);
+    else
+        nodes[nodeIdx] = node;
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::insertNode(
+    Context& ctx, std::size_t nodeIdx, const Node& node)
+{
+    if (ctx.inTransaction) {
+        UndoEntry entry(UndoEntry::nodeInserted, ctx.undoPageIdx);
+        entry.nodeIdx = nodeIdx;
+        ctx.addUndoEntry(entry);
+    }
+
+    if (ctx.compactNodes)
+        compactNodes.insert(
+            compactNodes.begin() + nodeIdx, makeCompactNode(node));
+    else
+        nodes.insert(nodes.begin() + nodeIdx, node);
+
+    if (nodeIdx < scanStartIdx)
+        scanStartIdx = nodeIdx;
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::eraseNode(
+    Context& ctx, std::size_t nodeIdx)
+{
+    if (ctx.inTransaction) {
+        UndoEntry entry(UndoEntry::nodeErased, ctx.undoPageIdx);
+        entry.nodeIdx = nodeIdx;
+        entry.node = getNode(ctx, nodeIdx);
+        ctx.addUndoEntry(entry);
+    }
+
+    if (ctx.compactNodes)
+        compactNodes.erase(compactNodes.begin() + nodeIdx);
+    else
+        nodes.erase(nodes.begin() + nodeIdx);
+
+    if (nodeIdx < scanStartIdx)
+        --scanStartIdx;
+}
+
+
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::isDeadNode(
+    const Context& ctx, const Node& node)
+{
+    return (
+        node.size.w < ctx.minRectSize.w
+        || node.size.h < ctx.minRectSize.h);
+}
+
+
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::needsPruning(const Context& ctx) const
+{
+    // Pruning doesn't change the layout, so we don't record it in
+    // the undo log and just try again after the transaction.
+    return (
+        !ctx.inTransaction
+        && (prunedMinRectSize.w != ctx.minRectSize.w
+            || prunedMinRectSize.h != ctx.minRectSize.h));
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::pruneNodes(Context& ctx)
+{
+    if (!needsPruning(ctx))
+        return;
+
+    prunedMinRectSize = ctx.minRectSize;
+
+    std::size_t dstIdx = 0;
+    std::size_t numPrunedBeforeScan = 0;
+    for (std::size_t srcIdx = 0; srcIdx < growDownRootBottomIdx; ++srcIdx) {
+        if (isDeadNode(ctx, getNode(ctx, srcIdx))) {
+            if (srcIdx < scanStartIdx)
+                ++numPrunedBeforeScan;
+            continue;
+        }
+
+        if (ctx.compactNodes)
+            compactNodes[dstIdx] = compactNodes[srcIdx];
+        else
+            nodes[dstIdx] = nodes[srcIdx];
+        ++dstIdx;
+    }
+
+    if (ctx.compactNodes)
+        compactNodes.erase(
+            compactNodes.begin() + dstIdx,
+            compactNodes.begin() + growDownRootBottomIdx);
+    else
+        nodes.erase(
+            nodes.begin() + dstIdx,
+            nodes.begin() + growDownRootBottomIdx);
+
+    scanStartIdx -= numPrunedBeforeScan;
+    growDownRootBottomIdx = dstIdx;
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::saveState(Context& ctx) const
+{
+    if (!ctx.inTransaction)
+        return;
+
+    UndoEntry entry(UndoEntry::stateChanged, ctx.undoPageIdx);
+    entry.rootSize = rootSize;
+    entry.growDownRootBottomIdx = growDownRootBottomIdx;
+    ctx.addUndoEntry(entry);
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::undo(Context& ctx, const UndoEntry& entry)
+{
+    assert(!ctx.inTransaction);
+
+    switch (entry.type) {
+        case UndoEntry::pageAdded:
+            assert(false);
+            break;
+        case UndoEntry::stateChanged:
+            rootSize = entry.rootSize;
+            growDownRootBottomIdx = entry.growDownRootBottomIdx;
+            break;
+        case UndoEntry::nodeChanged:
+            setNode(ctx, entry.nodeIdx, entry.node);
+            break;
+        case UndoEntry::nodeInserted:
+            eraseNode(ctx, entry.nodeIdx);
+            break;
+        case UndoEntry::nodeErased:
+            insertNode(ctx, entry.nodeIdx, entry.node);
+            break;
     }
+
+    resetScan();
+}
+
+
+template<typename GeomT>
+typename RectPacker<GeomT>::Page::CompactNode
+RectPacker<GeomT>::Page::makeCompactNode(const Node& node)
+{
+    CompactNode result;
+    result.x = static_cast<CompactCoordT>(node.pos.x);
+    result.y = static_cast<CompactCoordT>(node.pos.y);
+    result.w = static_cast<CompactCoordT>(node.size.w);
+    result.h = static_cast<CompactCoordT>(node.size.h);
+    return result;
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::initFixedSize(Context& ctx)
+{
+    assert(rootSize.w == 0);
+    assert(getNumNodes(ctx) == 0);
+
+    saveState(ctx);
+    rootSize = ctx.maxSize;
+    insertNode(
+        ctx,
+        0,
+        Node(
+            ctx.padding.left, ctx.padding.top,
+            ctx.maxSize.w, ctx.maxSize.h));
+
+    // There is no growDown() root, so the index is kept past the last
+    // node, which allows pruneNodes() to remove any node.
+    growDownRootBottomIdx = 1;
 }
 
 
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::tryInsert(
+    Context& ctx, const Size& rect, Position& pos)
+{
+    const std::size_t numNodes = getNumNodes(ctx);
+    assert(scanStartIdx <= numNodes);
+
+    std::size_t endIdx = numNodes;
+    if (numNodes - scanStartIdx > ctx.nodeBudget) {
+        endIdx = scanStartIdx + ctx.nodeBudget;
+        ctx.nodeBudgetExceeded = true;
+    }
+
+    std::size_t nodeIdx;
+    if (findNode(ctx, rect, scanStartIdx, endIdx, nodeIdx, pos)) {
+        ctx.nodeBudget -= nodeIdx - scanStartIdx + 1;
+
+        // The found node may still fit the next rect of the same
+        // size after subdivision.
+        scanStartIdx = nodeIdx;
+        saveState(ctx);
+        subdivideNode(ctx, nodeIdx, rect);
+        return true;
+    }
+
+    ctx.nodeBudget -= endIdx - scanStartIdx;
+    scanStartIdx = endIdx;
+    return false;
+}
+
+
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::findNode(
+    const Context& ctx, const Size& rect,
+    std::size_t startIdx, std::size_t endIdx,
+    std::size_t& nodeIdx, Position& pos) const
+{
+    assert(endIdx <= getNumNodes(ctx));
+
+    if (ctx.compactNodes) {
+        // The rect is not bigger than maxSize, so it fits as well.
+        const CompactCoordT rectW = static_cast<CompactCoordT>(rect.w);
+        const CompactCoordT rectH = static_cast<CompactCoordT>(rect.h);
+
+        for (nodeIdx = startIdx; nodeIdx < endIdx; ++nodeIdx) {
+            const CompactNode& node = compactNodes[nodeIdx];
+            if (rectW <= node.w && rectH <= node.h) {
+                pos = Position(node.x, node.y);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    for (nodeIdx = startIdx; nodeIdx < endIdx; ++nodeIdx) {
+        const Node& node = nodes[nodeIdx];
+        if (rect.w <= node.size.w && rect.h <= node.size.h) {
+            pos = node.pos;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::findLiveNode(
+    const Context& ctx, const Size& rect,
+    std::size_t& nodeIdx, Position& pos) const
+{
+    const std::size_t numNodes = getNumNodes(ctx);
+    const bool pruning = needsPruning(ctx);
+
+    for (std::size_t startIdx = 0;
+            findNode(ctx, rect, startIdx, numNodes, nodeIdx, pos);
+            startIdx = nodeIdx + 1)
+        if (!pruning
+                || nodeIdx >= growDownRootBottomIdx
+                || !isDeadNode(ctx, getNode(ctx, nodeIdx)))
+            return true;
+
+    return false;
+}
+
+
+/**
+ * Called after a rectangle was inserted in the top left corner of
+ * a free node to create child nodes from free space, if any.
+ *
+ * The node is first cut horizontally along the rect's bottom,
+ * then vertically along the right edge of the rect. Splitting
+ * that way is crucial for the algorithm to work correctly.
+ *
+ *      +---+
+ *      |   |
+ *  +---+---+
+ *  |       |
+ *  +-------+
+ */
+template<typename GeomT>
+void RectPacker<GeomT>::Page::subdivideNode(
+    Context& ctx, std::size_t nodeIdx, const Size& rect)
+{
+    assert(nodeIdx < getNumNodes(ctx));
+
+    Node node = getNode(ctx, nodeIdx);
+
+    assert(node.size.w >= rect.w);
+    const GeomT rightW = node.size.w - rect.w;
+    const bool hasSpaceRight = rightW > ctx.spacing.x;
+
+    assert(node.size.h >= rect.h);
+    const GeomT bottomH = node.size.h - rect.h;
+    const bool hasSpaceBelow = bottomH > ctx.spacing.y;
+
+    // Right and bottom nodes, in this order, replace the current.
+    Node newNodes[2] = {node, node};
+    std::size_t numNewNodes = 0;
+
+    if (hasSpaceRight) {
+        Node& rightNode = newNodes[numNewNodes++];
+        rightNode.pos.x += rect.w + ctx.spacing.x;
+        rightNode.size.w = rightW - ctx.spacing.x;
+        rightNode.size.h = rect.h;
+    }
+
+    if (hasSpaceBelow) {
+        Node& bottomNode = newNodes[numNewNodes++];
+        bottomNode.pos.y += rect.h + ctx.spacing.y;
+        bottomNode.size.h = bottomH - ctx.spacing.y;
+    }
+
+    if (numNewNodes == 2 && nodeIdx <= growDownRootBottomIdx)
+        ++growDownRootBottomIdx;
+    else if (numNewNodes == 0 && nodeIdx < growDownRootBottomIdx)
+        --growDownRootBottomIdx;
+
+    // Dead nodes are dropped right away if pruneNodes() would
+    // remove them.
+    std::size_t numKeptNodes = 0;
+    for (std::size_t i = 0; i < numNewNodes; ++i) {
+        const Node& newNode = newNodes[i];
+        if (nodeIdx + numKeptNodes < growDownRootBottomIdx
+                && isDeadNode(ctx, newNode)) {
+            --growDownRootBottomIdx;
+            continue;
+        }
+
+        if (numKeptNodes == 0)
+            setNode(ctx, nodeIdx, newNode);
+        else
+            insertNode(ctx, nodeIdx + numKeptNodes, newNode);
+        ++numKeptNodes;
+    }
+
+    if (numKeptNodes == 0)
+        eraseNode(ctx, nodeIdx);
+}
+
+
+template<typename GeomT>
+typename RectPacker<GeomT>::Page::Growth::Type
+RectPacker<GeomT>::Page::getGrowth(
+    const Context& ctx, const Size& rect) const
+{
+    assert(ctx.maxSize.w >= rootSize.w);
+    const GeomT freeW = ctx.maxSize.w - rootSize.w;
+    assert(ctx.maxSize.h >= rootSize.h);
+    const GeomT freeH = ctx.maxSize.h - rootSize.h;
+
+    const bool canGrowDown = (
+        freeH >= rect.h && freeH - rect.h >= ctx.spacing.y);
+    const bool mustGrowDown = (
+        canGrowDown
+        && freeW >= ctx.spacing.x
+        && (rootSize.w + ctx.spacing.x
+            >= rootSize.h + rect.h + ctx.spacing.y));
+    if (mustGrowDown)
+        return Growth::down;
+
+    const bool canGrowRight = (
+        freeW >= rect.w && freeW - rect.w >= ctx.spacing.x);
+    if (canGrowRight)
+        return Growth::right;
+
+    if (canGrowDown)
+        return Growth::down;
+
+    return Growth::none;
+}
+
+
+template<typename GeomT>
+bool RectPacker<GeomT>::Page::tryGrow(
+    Context& ctx, const Size& rect, Position& pos)
+{
+    switch (getGrowth(ctx, rect)) {
+        case Growth::none:
+            break;
+        case Growth::down:
+            saveState(ctx);
+            growDown(ctx, rect, pos);
+            return true;
+        case Growth::right:
+            saveState(ctx);
+            growRight(ctx, rect, pos);
+            return true;
+    }
+
+    return false;
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::growDown(
+    Context& ctx, const Size& rect, Position& pos)
+{
+    assert(ctx.maxSize.h > rootSize.h);
+    assert(ctx.maxSize.h - rootSize.h >= rect.h);
+    assert(ctx.maxSize.h - rootSize.h - rect.h >= ctx.spacing.y);
+
+    pos.x = ctx.padding.left;
+    pos.y = ctx.padding.top + rootSize.h + ctx.spacing.y;
+
+    if (rootSize.w < rect.w) {
+        if (rect.w - rootSize.w > ctx.spacing.x) {
+            // The auxiliary node becomes the right child of the new
+            // root. It contains the current root (bottom child) and
+            // free space at the current root's right (right child).
+            const Node node(
+                ctx.padding.left + rootSize.w + ctx.spacing.x,
+                ctx.padding.top,
+                rect.w - rootSize.w - ctx.spacing.x,
+                rootSize.h);
+            if (!isDeadNode(ctx, node)) {
+                insertNode(ctx, 0, node);
+                ++growDownRootBottomIdx;
+            }
+        }
+
+        rootSize.w = rect.w;
+    } else if (rootSize.w - rect.w > ctx.spacing.x) {
+        // Free space at the right of the inserted rect becomes the
+        // right child of the rect's node, which in turn is the
+        // bottom child of the new root.
+        const Node node(
+            pos.x + rect.w + ctx.spacing.x,
+            pos.y,
+            rootSize.w - rect.w - ctx.spacing.x,
+            rect.h);
+
+        // The inserted node is visited before the node from the next
+        // growDown() since the current new root will be the right
+        // child of the next root.
+        if (!isDeadNode(ctx, node)) {
+            insertNode(ctx, growDownRootBottomIdx, node);
+            ++growDownRootBottomIdx;
+        }
+    }
+
+    rootSize.h += ctx.spacing.y + rect.h;
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Page::growRight(
+    Context& ctx, const Size& rect, Position& pos)
+{
+    assert(ctx.maxSize.w > rootSize.w);
+    assert(ctx.maxSize.w - rootSize.w >= rect.w);
+    assert(ctx.maxSize.w - rootSize.w - rect.w >= ctx.spacing.x);
+
+    pos.x = ctx.padding.left + rootSize.w + ctx.spacing.x;
+    pos.y = ctx.padding.top;
+
+    if (rootSize.h < rect.h) {
+        if (rect.h - rootSize.h > ctx.spacing.y)
+            // The auxiliary node becomes the bottom child of the
+            // new root. It contains the current root (right child)
+            // and free space at the current root's bottom, if any
+            // (bottom child).
+            insertNode(
+                ctx,
+                getNumNodes(ctx),
+                Node(
+                    ctx.padding.left,
+                    ctx.padding.top + rootSize.h + ctx.spacing.y,
+                    rootSize.w,
+                    rect.h - rootSize.h - ctx.spacing.y));
+
+        rootSize.h = rect.h;
+    } else if (rootSize.h - rect.h > ctx.spacing.y) {
+        // Free space at the bottom of the inserted rect becomes the
+        // bottom child of the rect's node, which in turn is the
+        // right child of the new root node.
+        const Node node(
+            pos.x,
+            pos.y + rect.h + ctx.spacing.y,
+            rect.w,
+            rootSize.h - rect.h - ctx.spacing.y);
+        if (!isDeadNode(ctx, node)) {
+            insertNode(ctx, 0, node);
+            ++growDownRootBottomIdx;
+        }
+    }
+
+    rootSize.w += ctx.spacing.x + rect.w;
+}
+
+
+template<typename GeomT>
+RectPacker<GeomT>::Context::Context(
+    GeomT maxPageWidth, GeomT maxPageHeight,
+    const Spacing& rectsSpacing, const Padding& pagePadding)
+        : maxSize(maxPageWidth, maxPageHeight)
+        , spacing(rectsSpacing)
+        , padding(pagePadding)
+        , compactNodes(false)
+        , fixedPageSize(false)
+        , minRectSize(0, 0)
+        , nodeBudget(0)
+        , nodeBudgetExceeded(false)
+        , inTransaction(false)
+        , undoPageIdx(0)
+        , undoLog()
+{
+    if (maxSize.w < 0)
+        maxSize.w = 0;
+    if (maxSize.h < 0)
+        maxSize.h = 0;
+
+    if (spacing.x < 0)
+        spacing.x = 0;
+    if (spacing.y < 0)
+        spacing.y = 0;
+
+    subtractPadding(padding.top, maxSize.h);
+    subtractPadding(padding.bottom, maxSize.h);
+    subtractPadding(padding.left, maxSize.w);
+    subtractPadding(padding.right, maxSize.w);
+
+    compactNodes = (
+        CompactCoord::canHold(padding.left + maxSize.w)
+        && CompactCoord::canHold(padding.top + maxSize.h));
+}
+
+
+template<typename GeomT>
+void RectPacker<GeomT>::Context::subtractPadding(
+    GeomT& padding, GeomT& size)
+{
+    if (padding < 0)
+        padding = 0;
+    else if (padding < size)
+        size -= padding;
+    else {
+        padding = size;
+        size = 0;
+    }
+}
+
+
+/**
+ * Finder of the minimal page size that holds all rectangles.
+ *
+ * PageSizeFinder is for cases when all rectangles should go to
+ * a single page of the smallest possible size, like a texture atlas.
+ * The page can either have a fixed aspect ratio (square by default)
+ * or have power-of-two sides.
+ *
+ * The finder skips sizes that can't hold the rectangles because of
+ * their total area or dimensions, and then searches the remaining
+ * range by trying to pack the rectangles. For a fixed aspect ratio,
+ * it checks several heights per round: first growing exponentially
+ * to find a height that fits, and then splitting the range between
+ * the biggest known height that doesn't fit and the smallest one that
+ * does. Power-of-two sizes are checked in order of increasing area.
+ *
+ * Keep in mind that whether the rectangles fit is not strictly
+ * monotonic in the page size: in rare cases, a page slightly smaller
+ * than the found one can hold the rectangles as well. The result is
+ * deterministic and doesn't depend on the number of threads.
+ *
+ * GeomT must be an integer type; other types don't compile.
+ *
+ * \tparam GeomT numeric type to use for geometry
+ */
+template<typename GeomT = int>
+class PageSizeFinder {
+public:
+    typedef RectPacker<GeomT> Packer;
+    typedef typename Packer::Spacing Spacing;
+    typedef typename Packer::Padding Padding;
+
+    /**
+     * PageSizeFinder constructor.
+     *
+     * The arguments have the same meaning as for
+     * RectPacker::RectPacker(); the maximum page size limits
+     * the search.
+     */
+    PageSizeFinder(
+            GeomT maxPageWidth, GeomT maxPageHeight,
+            const Spacing& rectsSpacing = Spacing(0),
+            const Padding& pagePadding = Padding(0))
+        : maxPageSize(maxPageWidth, maxPageHeight)
+        , spacing(rectsSpacing)
+        , padding(pagePadding)
+        , aspectRatio(1, 1)
+        , powerOfTwo(false)
+        , rects()
+        #ifdef DP_RECT_PACK_THREADS
+        , threads()
+        #endif
+    {
+        // GeomT must be an integer type.
+        (void)sizeof(
+            detail::StaticAssert<std::numeric_limits<GeomT>::is_integer>);
+    }
+
+    /**
+     * Set the aspect ratio of the page as width:height.
+     *
+     * The default is 1:1 (square). The width of the page is rounded
+     * up to the nearest integer. Ignored if power-of-two sizes are
+     * enabled.
+     */
+    void setAspectRatio(GeomT width, GeomT height)
+    {
+        assert(width > 0);
+        assert(height > 0);
+        aspectRatio = Size(width, height);
+    }
+
+    /**
+     * Set whether both sides of the page should be powers of two.
+     *
+     * The sides include the padding and can be different.
+     */
+    void setPowerOfTwo(bool newPowerOfTwo)
+    {
+        powerOfTwo = newPowerOfTwo;
+    }
+
+#ifdef DP_RECT_PACK_THREADS
+    /**
+     * Set the number of threads to check page sizes.
+     *
+     * \note Only available if DP_RECT_PACK_THREADS is defined.
+     *
+     * \sa RectPacker::setSearchThreads()
+     */
+    void setNumThreads(std::size_t numThreads)
+    {
+        threads.setNumThreads(numThreads);
+    }
+#endif
+
+    /**
+     * Add a rectangle.
+     *
+     * The rectangles don't have to be sorted.
+     */
+    void addRect(GeomT width, GeomT height)
+    {
+        rects.push_back(Size(width, height));
+    }
+
+    /**
+     * Find the page size.
+     *
+     * If inserted in a RectPacker constructed with the found size and
+     * the spacing and padding of the finder, the rectangles sorted
+     * as recommended in RectPacker::insert() will fit in a single
+     * page. The size of that page may be smaller than the found
+     * size.
+     *
+     * \param[out] width width of the page
+     * \param[out] height height of the page
+     * \returns false if the rectangles don't fit in a single page of
+     *     the maximum size, or if any rectangle has invalid size
+     */
+    bool find(GeomT& width, GeomT& height);
+private:
+    struct Size {
+        GeomT w;
+        GeomT h;
+
+        Size(GeomT w, GeomT h)
+            : w(w)
+            , h(h)
+        {}
+    };
+
+    // The number of page sizes checked per search round. It doesn't
+    // depend on the number of threads so that the result doesn't.
+    static const std::size_t numCandidatesPerRound = 4;
+
+    Size maxPageSize;
+    Spacing spacing;
+    Padding padding;
+    Size aspectRatio;
+    bool powerOfTwo;
+    std::vector<Size> rects;
+    #ifdef DP_RECT_PACK_THREADS
+    detail::LazyThreadPool threads;
+    #endif
+
+    static bool compareRects(const Size& a, const Size& b);
+    static bool comparePowerOfTwoSizes(const Size& a, const Size& b);
+
+    bool fits(const Size& pageSize) const;
+    bool isBigEnough(
+        const Size& pageSize, const Size& maxRectSize,
+        double rectsArea) const;
+    std::size_t findFirstFit(const std::vector<Size>& candidates);
+    Size getSizeForHeight(GeomT height) const;
+    bool findWithAspectRatio(
+        const Size& maxRectSize, double rectsArea, Size& result);
+    bool findPowerOfTwo(
+        const Size& maxRectSize, double rectsArea, Size& result);
+};
+
+
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::find(GeomT& width, GeomT& height)
+{
+    if (rects.empty())
+        return false;
+
+    std::stable_sort(rects.begin(), rects.end(), compareRects);
+
+    // Every rect takes its spacing at the right and bottom, and so
+    // does the page if we extend it by the spacing.
+    Size maxRectSize(0, 0);
+    double rectsArea = 0;
+    for (std::size_t i = 0; i < rects.size(); ++i) {
+        const Size& rect = rects[i];
+        if (!(rect.w > 0 && rect.h > 0))
+            return false;
+
+        if (rect.w > maxRectSize.w)
+            maxRectSize.w = rect.w;
+        if (rect.h > maxRectSize.h)
+            maxRectSize.h = rect.h;
+
+        rectsArea += (
+            (static_cast<double>(rect.w) + spacing.x)
+            * (static_cast<double>(rect.h) + spacing.y));
+    }
+
+    Size result(0, 0);
+    if (!(powerOfTwo
+            ? findPowerOfTwo(maxRectSize, rectsArea, result)
+            : findWithAspectRatio(maxRectSize, rectsArea, result)))
+        return false;
+
+    width = result.w;
+    height = result.h;
+    return true;
+}
+
+
+// Order recommended for RectPacker::insert()
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::compareRects(const Size& a, const Size& b)
+{
+    if (a.h != b.h)
+        return a.h > b.h;
+    return a.w > b.w;
+}
+
+
+// Order by area, then by the longer side, and then prefer wider
+// pages.
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::comparePowerOfTwoSizes(
+    const Size& a, const Size& b)
+{
+    const double areaA = static_cast<double>(a.w) * a.h;
+    const double areaB = static_cast<double>(b.w) * b.h;
+    if (areaA != areaB)
+        return areaA < areaB;
+
+    const GeomT longSideA = a.w > a.h ? a.w : a.h;
+    const GeomT longSideB = b.w > b.h ? b.w : b.h;
+    if (longSideA != longSideB)
+        return longSideA < longSideB;
+
+    return a.w > b.w;
+}
+
+
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::fits(const Size& pageSize) const
+{
+    Packer packer(pageSize.w, pageSize.h, spacing, padding);
+
+    for (std::size_t runBegin = 0; runBegin < rects.size();) {
+        const Size& rect = rects[runBegin];
+        std::size_t runEnd = runBegin + 1;
+        while (runEnd < rects.size()
+                && rects[runEnd].w == rect.w
+                && rects[runEnd].h == rect.h)
+            ++runEnd;
+
+        if (packer.insertRepeated(
+                    rect.w, rect.h, runEnd - runBegin,
+                    detail::DiscardIterator()) != InsertStatus::ok
+                || packer.getNumPages() > 1)
+            return false;
+
+        runBegin = runEnd;
+    }
+
+    return true;
+}
+
+
+// Quick check that doesn't involve packing.
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::isBigEnough(
+    const Size& pageSize, const Size& maxRectSize, double rectsArea) const
+{
+    const double padW = static_cast<double>(padding.left) + padding.right;
+    const double padH = static_cast<double>(padding.top) + padding.bottom;
+    const double freeW = static_cast<double>(pageSize.w) - padW;
+    const double freeH = static_cast<double>(pageSize.h) - padH;
+
+    return (
+        freeW >= maxRectSize.w
+        && freeH >= maxRectSize.h
+        && (freeW + spacing.x) * (freeH + spacing.y) >= rectsArea);
+}
+
+
+template<typename GeomT>
+std::size_t PageSizeFinder<GeomT>::findFirstFit(
+    const std::vector<Size>& candidates)
+{
+    #ifdef DP_RECT_PACK_THREADS
+    if (threads.getNumThreads() > 1 && candidates.size() > 1) {
+        // Same as RectPacker::findPageParallel()
+        std::atomic<std::size_t> nextIdx(0);
+        std::atomic<std::size_t> foundIdx(candidates.size());
+
+        threads.getPool().run([&]{
+            for (;;) {
+                const std::size_t idx = nextIdx.fetch_add(1);
+                if (idx >= foundIdx.load())
+                    break;
+
+                if (!fits(candidates[idx]))
+                    continue;
+
+                std::size_t curFoundIdx = foundIdx.load();
+                while (idx < curFoundIdx
+                        && !foundIdx.compare_exchange_weak(
+                            curFoundIdx, idx))
+                    ;
+                break;
+            }
+        });
+
+        return foundIdx.load();
+    }
+    #endif
+
+    for (std::size_t i = 0; i < candidates.size(); ++i)
+        if (fits(candidates[i]))
+            return i;
+
+    return candidates.size();
+}
+
+
+template<typename GeomT>
+typename PageSizeFinder<GeomT>::Size
+PageSizeFinder<GeomT>::getSizeForHeight(GeomT height) const
+{
+    const double width = std::ceil(
+        static_cast<double>(height) * aspectRatio.w / aspectRatio.h);
+    if (width >= static_cast<double>(maxPageSize.w))
+        return Size(maxPageSize.w, height);
+
+    return Size(static_cast<GeomT>(width), height);
+}
+
+
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::findWithAspectRatio(
+    const Size& maxRectSize, double rectsArea, Size& result)
+{
+    // Heights in (minH, maxH] are the search range: we know that
+    // minH is too small, and maxH is the biggest height allowed.
+    GeomT minH = 0;
+    GeomT maxH = maxPageSize.h;
+    const double maxHForWidth = std::floor(
+        static_cast<double>(maxPageSize.w)
+        * aspectRatio.h / aspectRatio.w);
+    if (maxHForWidth < static_cast<double>(maxH))
+        maxH = static_cast<GeomT>(maxHForWidth);
+
+    if (!isBigEnough(getSizeForHeight(maxH), maxRectSize, rectsArea))
+        return false;
+
+    // The smallest height that passes isBigEnough(), which is
+    // monotonic in height.
+    GeomT boundH = maxH;
+    while (boundH - minH > 1) {
+        const GeomT midH = minH + (boundH - minH) / 2;
+        if (isBigEnough(getSizeForHeight(midH), maxRectSize, rectsArea))
+            boundH = midH;
+        else
+            minH = midH;
+    }
+
+    std::vector<Size> candidates;
+    candidates.reserve(numCandidatesPerRound);
+
+    // Grow exponentially until we find a height that fits.
+    GeomT h = boundH;
+    for (;;) {
+        candidates.clear();
+        while (candidates.size() < numCandidatesPerRound) {
+            candidates.push_back(getSizeForHeight(h));
+            if (h == maxH)
+                break;
+            h = h > maxH - h ? maxH : h + h;
+        }
+
+        const std::size_t idx = findFirstFit(candidates);
+        if (idx > 0)
+            minH = candidates[idx - 1].h;
+
+        if (idx < candidates.size()) {
+            maxH = candidates[idx].h;
+            break;
+        }
+
+        if (candidates.back().h == maxH)
+            return false;
+    }
+
+    // Split (minH, maxH).
+    while (maxH - minH > 1) {
+        candidates.clear();
+        const GeomT step = (
+            (maxH - minH)
+            / static_cast<GeomT>(numCandidatesPerRound + 1));
+        GeomT candidateH = minH;
+        for (std::size_t i = 0; i < numCandidatesPerRound; ++i) {
+            candidateH += step > 0 ? step : 1;
+            if (candidateH >= maxH)
+                break;
+            candidates.push_back(getSizeForHeight(candidateH));
+        }
+
+        const std::size_t idx = findFirstFit(candidates);
+        if (idx > 0)
+            minH = candidates[idx - 1].h;
+        if (idx < candidates.size())
+            maxH = candidates[idx].h;
+    }
+
+    result = getSizeForHeight(maxH);
+    return true;
+}
+
+
+template<typename GeomT>
+bool PageSizeFinder<GeomT>::findPowerOfTwo(
+    const Size& maxRectSize, double rectsArea, Size& result)
+{
+    std::vector<GeomT> widths;
+    for (GeomT w = 1; w <= maxPageSize.w; w += w) {
+        widths.push_back(w);
+        if (w > maxPageSize.w - w)
+            break;
+    }
+
+    std::vector<GeomT> heights;
+    for (GeomT h = 1; h <= maxPageSize.h; h += h) {
+        heights.push_back(h);
+        if (h > maxPageSize.h - h)
+            break;
+    }
+
+    std::vector<Size> sizes;
+    for (std::size_t i = 0; i < widths.size(); ++i)
+        for (std::size_t j = 0; j < heights.size(); ++j) {
+            const Size size(widths[i], heights[j]);
+            if (isBigEnough(size, maxRectSize, rectsArea))
+                sizes.push_back(size);
+        }
+
+    std::sort(sizes.begin(), sizes.end(), comparePowerOfTwoSizes);
+
+    std::vector<Size> candidates;
+    candidates.reserve(numCandidatesPerRound);
+    for (std::size_t i = 0; i < sizes.size();) {
+        candidates.clear();
+        for (; i < sizes.size()
+                && candidates.size() < numCandidatesPerRound; ++i)
+            candidates.push_back(sizes[i]);
+
+        const std::size_t idx = findFirstFit(candidates);
+        if (idx < candidates.size()) {
+            result = candidates[idx];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Window that sorts rectangles of an unsorted stream before packing.
+ *
+ * RectPacker gives the best results when rectangles are sorted as
+ * described in RectPacker::insert(), which is impossible if they
+ * arrive one by one. ReorderWindow buffers up to maxRects
+ * rectangles, sorts them, and inserts them in the packer, so that
+ * a bigger window gives denser pages at the cost of latency and
+ * memory. Optionally, the window is also flushed when the oldest
+ * rectangle has waited for too long; see setMaxDelay().
+ *
+ * Results are passed to the callback as
+ * \code
+ *     callback(id, result);
+ * \endcode
+ * where id is the value given to add() and result is
+ * RectPacker::InsertResult. Rectangles are reported in the order of
+ * insertion, not in the order of add() calls. The callback must not
+ * call methods of the window.
+ *
+ * \tparam GeomT numeric type to use for geometry
+ * \tparam Callback function object called for every rectangle
+ */
+template<typename GeomT, typename Callback>
+class ReorderWindow {
+public:
+    typedef RectPacker<GeomT> Packer;
+
+    /**
+     * ReorderWindow constructor.
+     *
+     * \param packer packer to insert rectangles in; must outlive the
+     *     window
+     * \param callback function object to receive results
+     * \param maxRects maximum number of buffered rectangles; 0 and 1
+     *     insert every rectangle immediately
+     */
+    ReorderWindow(Packer& packer, Callback callback, std::size_t maxRects)
+        : packer(packer)
+        , callback(callback)
+        , maxRects(maxRects)
+        , maxDelay(0)
+        , oldestTime(0)
+        , rects()
+        , results()
+    {}
+
+    /**
+     * Flush the window when the oldest rectangle has waited longer
+     * than maxDelay.
+     *
+     * The window doesn't read the clock: time is passed to add() and
+     * poll() in any units, like microseconds of a monotonic clock.
+     *
+     * \param newMaxDelay maximum delay; 0 (default) disables
+     *     the limit
+     */
+    void setMaxDelay(double newMaxDelay)
+    {
+        maxDelay = newMaxDelay;
+    }
+
+    /**
+     * Return the number of buffered rectangles.
+     */
+    std::size_t getNumPending() const
+    {
+        return rects.size();
+    }
+
+    /**
+     * Add a rectangle.
+     *
+     * The window is flushed if it's full or, if setMaxDelay() is
+     * used, if the oldest rectangle is too old.
+     *
+     * \param width width of the rectangle
+     * \param height height of the rectangle
+     * \param id value passed to the callback with the result
+     * \param time current time; only used with setMaxDelay()
+     */
+    void add(GeomT width, GeomT height, std::size_t id, double time = 0);
+
+    /**
+     * Flush the window if the oldest rectangle is too old.
+     *
+     * Call this periodically when rectangles arrive slowly.
+     *
+     * \param time current time
+     *
+     * \sa setMaxDelay()
+     */
+    void poll(double time);
+
+    /**
+     * Sort and insert all buffered rectangles.
+     *
+     * Call this at the end of the stream.
+     */
+    void flush();
+private:
+    struct Rect {
+        GeomT w;
+        GeomT h;
+        std::size_t id;
+    };
+
+    Packer& packer;
+    Callback callback;
+    std::size_t maxRects;
+    double maxDelay;
+    double oldestTime;
+    std::vector<Rect> rects;
+    std::vector<typename Packer::InsertResult> results;
+
+    static bool compareRects(const Rect& a, const Rect& b);
+};
+
+
+template<typename GeomT, typename Callback>
+void ReorderWindow<GeomT, Callback>::add(
+    GeomT width, GeomT height, std::size_t id, double time)
+{
+    if (rects.empty())
+        oldestTime = time;
+
+    Rect rect;
+    rect.w = width;
+    rect.h = height;
+    rect.id = id;
+    rects.push_back(rect);
+
+    if (rects.size() >= maxRects)
+        flush();
+    else
+        poll(time);
+}
+
+
+template<typename GeomT, typename Callback>
+void ReorderWindow<GeomT, Callback>::poll(double time)
+{
+    if (maxDelay > 0 && !rects.empty() && time - oldestTime >= maxDelay)
+        flush();
+}
+
+
+template<typename GeomT, typename Callback>
+void ReorderWindow<GeomT, Callback>::flush()
+{
+    // Stable, so that rectangles of the same size keep the order
+    // in which they were added.
+    std::stable_sort(rects.begin(), rects.end(), compareRects);
+
+    for (std::size_t i = 0; i < rects.size();) {
+        const Rect& rect = rects[i];
+        std::size_t runEnd = i + 1;
+        while (runEnd < rects.size()
+                && rects[runEnd].w == rect.w
+                && rects[runEnd].h == rect.h)
+            ++runEnd;
+
+        results.clear();
+        const InsertStatus::Type status = packer.insertRepeated(
+            rect.w, rect.h, runEnd - i, std::back_inserter(results));
+        if (status != InsertStatus::ok) {
+            typename Packer::InsertResult result;
+            result.status = status;
+            results.assign(runEnd - i, result);
+        }
+
+        for (std::size_t j = 0; j < results.size(); ++j)
+            callback(rects[i + j].id, results[j]);
+
+        i = runEnd;
+    }
+
+    rects.clear();
+}
+
+
+// Order recommended for RectPacker::insert()
+template<typename GeomT, typename Callback>
+bool ReorderWindow<GeomT, Callback>::compareRects(
+    const Rect& a, const Rect& b)
+{
+    if (a.h != b.h)
+        return a.h > b.h;
+    return a.w > b.w;
+}
+
+
+#ifdef DP_RECT_PACK_THREADS
+
+
+/**
+ * Packer of independent groups of rectangles.
+ *
+ * GroupPacker is for cases when you need several independent sets
+ * of pages (atlases), like one per material or font. Every group
+ * has its own RectPacker settings. Rectangles of a group are
+ * sorted as recommended in RectPacker::insert() and inserted in a
+ * separate RectPacker. Groups are packed concurrently, the biggest
+ * first; the result doesn't depend on the number of threads.
+ *
+ * \note Only available if DP_RECT_PACK_THREADS is defined before
+ *     including the library, which requires C++11.
+ *
+ * \tparam GeomT numeric type to use for geometry
+ */
+template<typename GeomT = int>
+class GroupPacker {
+public:
+    typedef RectPacker<GeomT> Packer;
+    typedef typename Packer::Spacing Spacing;
+    typedef typename Packer::Padding Padding;
+    typedef typename Packer::InsertResult InsertResult;
+
+    GroupPacker()
+        : groups()
+        , rects()
+        , results()
+        , pageSizes()
+        , threads()
+    {}
+
+    /**
+     * Return the number of threads used by pack().
+     */
+    std::size_t getNumThreads() const
+    {
+        return threads.getNumThreads();
+    }
+
+    /**
+     * Set the number of threads used by pack().
+     *
+     * \param numThreads number of threads, including the one that
+     *     calls pack(); 0 and 1 mean that all groups are packed by
+     *     the calling thread. The default is 1.
+     */
+    void setNumThreads(std::size_t numThreads)
+    {
+        threads.setNumThreads(numThreads);
+    }
+
+    /**
+     * Add a new group.
+     *
+     * Rectangles added with addRect() go to the last added group.
+     * See RectPacker::RectPacker() for the meaning of the arguments.
+     *
+     * \returns index of the group
+     */
+    std::size_t addGroup(
+        GeomT maxPageWidth, GeomT maxPageHeight,
+        const Spacing& rectsSpacing = Spacing(0),
+        const Padding& pagePadding = Padding(0));
+
+    /**
+     * Add a rectangle to the last added group.
+     *
+     * \returns index of the rectangle; rectangles of a group have
+     *     consecutive indices
+     */
+    std::size_t addRect(GeomT width, GeomT height);
+
+    /**
+     * Pack all groups.
+     *
+     * Every call packs all groups from scratch, so you can add more
+     * groups and rectangles and call pack() again.
+     */
+    void pack();
+
+    std::size_t getNumGroups() const
+    {
+        return groups.size();
+    }
+
+    /**
+     * Return the index of the first rectangle of the group.
+     */
+    std::size_t getGroupFirstRect(std::size_t groupIndex) const
+    {
+        return groups[groupIndex].firstRect;
+    }
+
+    std::size_t getGroupNumRects(std::size_t groupIndex) const
+    {
+        return groups[groupIndex].numRects;
+    }
+
+    /**
+     * Return the number of pages of the group.
+     *
+     * \pre pack() was called after the last addGroup() or addRect()
+     */
+    std::size_t getNumPages(std::size_t groupIndex) const
+    {
+        return groups[groupIndex].numPages;
+    }
+
+    /**
+     * Return the size of the page of the group.
+     *
+     * \pre pack() was called after the last addGroup() or addRect()
+     */
+    void getPageSize(
+        std::size_t groupIndex, std::size_t pageIndex,
+        GeomT& width, GeomT& height) const
+    {
+        assert(pageIndex < groups[groupIndex].numPages);
+        const Size& size = pageSizes[
+            groups[groupIndex].firstPage + pageIndex];
+        width = size.w;
+        height = size.h;
+    }
+
+    /**
+     * Return results of all rectangles.
+     *
+     * The results are in the order of addRect() calls, so that
+     * results of a group form a contiguous range that starts at
+     * getGroupFirstRect(). InsertResult::pageIndex is the index of
+     * the page within the group.
+     *
+     * \pre pack() was called after the last addGroup() or addRect()
+     */
+    const std::vector<InsertResult>& getResults() const
+    {
+        return results;
+    }
+private:
+    struct Group {
+        GeomT maxPageWidth;
+        GeomT maxPageHeight;
+        Spacing spacing;
+        Padding padding;
+        std::size_t firstRect;
+        std::size_t numRects;
+        std::size_t firstPage;
+        std::size_t numPages;
+
+        Group(
+                GeomT maxPageWidth, GeomT maxPageHeight,
+                const Spacing& spacing, const Padding& padding,
+                std::size_t firstRect)
+            : maxPageWidth(maxPageWidth)
+            , maxPageHeight(maxPageHeight)
+            , spacing(spacing)
+            , padding(padding)
+            , firstRect(firstRect)
+            , numRects(0)
+            , firstPage(0)
+            , numPages(0)
+        {}
+    };
+
+    struct Size {
+        GeomT w;
+        GeomT h;
+    };
+
+    std::vector<Group> groups;
+    std::vector<Size> rects;
+    std::vector<InsertResult> results;
+    std::vector<Size> pageSizes;
+    detail::LazyThreadPool threads;
+
+    void packGroup(std::size_t groupIdx, std::vector<Size>& groupPages);
+};
+
+
+template<typename GeomT>
+std::size_t GroupPacker<GeomT>::addGroup(
+    GeomT maxPageWidth, GeomT maxPageHeight,
+    const Spacing& rectsSpacing, const Padding& pagePadding)
+{
+    groups.push_back(
+        Group(
+            maxPageWidth, maxPageHeight,
+            rectsSpacing, pagePadding,
+            rects.size()));
+    return groups.size() - 1;
+}
+
+
+template<typename GeomT>
+std::size_t GroupPacker<GeomT>::addRect(GeomT width, GeomT height)
+{
+    assert(!groups.empty());
+
+    Size rect;
+    rect.w = width;
+    rect.h = height;
+    rects.push_back(rect);
+    ++groups.back().numRects;
+
+    return rects.size() - 1;
+}
+
+
+template<typename GeomT>
+void GroupPacker<GeomT>::pack()
+{
+    results.assign(rects.size(), InsertResult());
+
+    std::vector<std::size_t> order(groups.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    // The biggest groups go first so that threads don't end up
+    // waiting for a single big group that was started last.
+    std::stable_sort(
+        order.begin(), order.end(),
+        [this](std::size_t a, std::size_t b)
+        {
+            return groups[a].numRects > groups[b].numRects;
+        });
+
+    std::vector<std::vector<Size>> groupPages(groups.size());
+    std::atomic<std::size_t> nextIdx(0);
+    const std::function<void()> job = [&]{
+        for (;;) {
+            const std::size_t i = nextIdx.fetch_add(1);
+            if (i >= order.size())
+                break;
+
+            packGroup(order[i], groupPages[order[i]]);
+        }
+    };
+
+    if (threads.getNumThreads() > 1)
+        threads.getPool().run(job);
+    else
+        job();
+
+    pageSizes.clear();
+    for (std::size_t i = 0; i < groups.size(); ++i) {
+        groups[i].firstPage = pageSizes.size();
+        groups[i].numPages = groupPages[i].size();
+        pageSizes.insert(
+            pageSizes.end(), groupPages[i].begin(), groupPages[i].end());
+    }
+}
+
+
+template<typename GeomT>
+void GroupPacker<GeomT>::packGroup(
+    std::size_t groupIdx, std::vector<Size>& groupPages)
+{
+    const Group& group = groups[groupIdx];
+
+    std::vector<std::size_t> order(group.numRects);
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = group.firstRect + i;
+
+    std::stable_sort(
+        order.begin(), order.end(),
+        [this](std::size_t a, std::size_t b)
+        {
+            if (rects[a].h != rects[b].h)
+                return rects[a].h > rects[b].h;
+            return rects[a].w > rects[b].w;
+        });
+
+    Packer packer(
+        group.maxPageWidth, group.maxPageHeight,
+        group.spacing, group.padding);
+
+    std::vector<InsertResult> runResults;
+    for (std::size_t runBegin = 0; runBegin < order.size();) {
+        const Size& rect = rects[order[runBegin]];
+        std::size_t runEnd = runBegin + 1;
+        while (runEnd < order.size()
+                && rects[order[runEnd]].w == rect.w
+                && rects[order[runEnd]].h == rect.h)
+            ++runEnd;
+
+        runResults.clear();
+        const InsertStatus::Type status = packer.insertRepeated(
+            rect.w, rect.h, runEnd - runBegin,
+            std::back_inserter(runResults));
+
+        for (std::size_t i = runBegin; i < runEnd; ++i)
+            if (status == InsertStatus::ok)
+                results[order[i]] = runResults[i - runBegin];
+            else
+                results[order[i]].status = status;
+
+        runBegin = runEnd;
+    }
+
+    groupPages.resize(packer.getNumPages());
+    for (std::size_t i = 0; i < groupPages.size(); ++i)
+        packer.getPageSize(i, groupPages[i].w, groupPages[i].h);
+}
+
+
+/**
+ * Rectangle packer that can be used from several threads at once.
+ *
+ * ConcurrentPacker is for cases when many threads allocate space
+ * from the same set of pages, like threads that rasterize glyphs
+ * for a single atlas. Instead of a single RectPacker behind a lock,
+ * it has several shards, each being a RectPacker with its own pages
+ * and its own lock. A thread inserts into its home shard; if another
+ * thread holds it, the rectangle goes to the first shard that is
+ * free, and the thread only waits if all shards are busy. Page
+ * indices are allocated from a single atomic counter, so pages of all
+ * shards form a single sequence. The table that maps page indices to
+ * shards is lock-free as well: it grows by chunks of doubling size
+ * that are never moved.
+ *
+ * Every insert() takes effect at once while the thread holds the
+ * lock of the shard, and a placement never changes afterwards, so
+ * the result can be used right away. However, the layout depends on
+ * the timing of the threads, and since each shard fills its own
+ * pages, there may be up to one partially filled page per shard
+ * more than with a single RectPacker. The number of shards is thus
+ * a tradeoff between throughput and density; the number of threads
+ * that insert at the same time is a good choice.
+ *
+ * As with RectPacker, rectangles should be sorted as described in
+ * RectPacker::insert() for better results; with several threads, it
+ * is enough that each thread inserts them in that order.
+ *
+ * \note Only available if DP_RECT_PACK_THREADS is defined before
+ *     including the library, which requires C++11.
+ *
+ * \tparam GeomT numeric type to use for geometry
+ */
+template<typename GeomT = int>
+class ConcurrentPacker {
+public:
+    typedef RectPacker<GeomT> Packer;
+    typedef typename Packer::Spacing Spacing;
+    typedef typename Packer::Padding Padding;
+    typedef typename Packer::InsertResult InsertResult;
+
+    /**
+     * Counters of lock contention in insert().
+     *
+     * \sa getContentionStats()
+     */
+    struct ContentionStats {
+        /**
+         * Total number of insert() calls.
+         */
+        std::size_t numInserts;
+
+        /**
+         * Number of insertions that found the home shard locked by
+         * another thread.
+         */
+        std::size_t numContended;
+
+        /**
+         * Number of contended insertions that went to another shard.
+         */
+        std::size_t numStolen;
+
+        /**
+         * Number of contended insertions that found all shards locked
+         * and waited for the home shard.
+         */
+        std::size_t numWaits;
+    };
+
+    /**
+     * ConcurrentPacker constructor.
+     *
+     * See RectPacker::RectPacker() for the meaning of the geometry
+     * arguments; they apply to all shards.
+     *
+     * \param numShards number of shards; 0 means the number of CPU
+     *     cores
+     */
+    ConcurrentPacker(
+        GeomT maxPageWidth, GeomT maxPageHeight,
+        const Spacing& rectsSpacing = Spacing(0),
+        const Padding& pagePadding = Padding(0),
+        std::size_t numShards = 0);
+
+    ~ConcurrentPacker();
+
+    std::size_t getNumShards() const
+    {
+        return shards.size();
+    }
+
+    /**
+     * Insert a rectangle.
+     *
+     * Can be called from any number of threads at once. The
+     * rectangle goes to the home shard of the calling thread if it's
+     * not locked by another thread. The home shard is the thread's
+     * number modulo the number of shards, where threads are numbered
+     * in the order in which they first call insert() of any
+     * ConcurrentPacker in the process. If the same threads insert
+     * from the start and there are at least as many shards as
+     * threads, each thread thus has a shard of its own; otherwise,
+     * several threads may share a home shard while others are idle,
+     * which costs some contention but is still correct.
+     *
+     * \param width width of the rectangle
+     * \param height height of the rectangle
+     * \returns InsertResult; see RectPacker::insert()
+     */
+    InsertResult insert(GeomT width, GeomT height);
+
+    /**
+     * Return the number of pages.
+     *
+     * Unlike RectPacker, the initial number of pages is 0, as pages
+     * only get their indices on the first insertion. While other
+     * threads insert rectangles, the value may be outdated as soon as
+     * it's returned.
+     */
+    std::size_t getNumPages() const
+    {
+        return numPages.load();
+    }
+
+    /**
+     * Return the current size of the page.
+     *
+     * \param pageIndex index of the page returned by insert() in the
+     *     same thread, or any index in range [0..getNumPages()) if
+     *     no insert() calls are in progress
+     * \param[out] width width of the page
+     * \param[out] height height of the page
+     */
+    void getPageSize(
+        std::size_t pageIndex, GeomT& width, GeomT& height) const;
+
+    /**
+     * Return contention counters accumulated since the construction
+     * or the last resetContentionStats() call.
+     *
+     * If other threads insert rectangles at the same time, the
+     * counters may be updated separately from each other.
+     */
+    ContentionStats getContentionStats() const;
+
+    void resetContentionStats();
+private:
+    struct Shard {
+        std::mutex mutex;
+        Packer packer;
+        // Global indices of the pages of the packer
+        std::vector<std::size_t> pageIndices;
+        // Number of insert() calls that locked the shard. Counting
+        // them per shard keeps uncontended insertions from touching
+        // memory shared with other threads.
+        std::size_t numInserts;
+
+        Shard(
+                GeomT maxPageWidth, GeomT maxPageHeight,
+                const Spacing& rectsSpacing, const Padding& pagePadding)
+            : mutex()
+            , packer(
+                maxPageWidth, maxPageHeight, rectsSpacing, pagePadding)
+            , pageIndices()
+            , numInserts(0)
+        {}
+    };
+
+    // Location of a page with the given global index
+    struct PageRef {
+        std::size_t shardIdx;
+        std::size_t pageIdx;
+    };
+
+    // Page refs are stored in chunks; chunk i holds
+    // firstPageRefChunkSize << i refs. Chunks are allocated on first
+    // use and never move, so pages can be added without a lock.
+    static const std::size_t firstPageRefChunkSize = 64;
+    static const std::size_t maxPageRefChunks = (
+        std::numeric_limits<std::size_t>::digits);
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<std::size_t> numPages;
+    std::atomic<PageRef*> pageRefChunks[maxPageRefChunks];
+
+    std::atomic<std::size_t> numContended;
+    std::atomic<std::size_t> numStolen;
+    std::atomic<std::size_t> numWaits;
+
+    // Insert into the shard whose lock is held by the caller.
+    InsertResult insertIntoShard(
+        std::size_t shardIdx, GeomT width, GeomT height);
+
+    // Return the ref of the page, allocating its chunk if needed.
+    PageRef& getPageRef(std::size_t pageIndex);
+    const PageRef& getPageRef(std::size_t pageIndex) const;
+
+    static void getPageRefLocation(
+        std::size_t pageIndex, std::size_t& chunkIdx, std::size_t& idx);
+};
+
+
+template<typename GeomT>
+ConcurrentPacker<GeomT>::ConcurrentPacker(
+    GeomT maxPageWidth, GeomT maxPageHeight,
+    const Spacing& rectsSpacing, const Padding& pagePadding,
+    std::size_t numShards)
+        : shards()
+        , numPages(0)
+        , numContended(0)
+        , numStolen(0)
+        , numWaits(0)
+{
+    for (std::size_t i = 0; i < maxPageRefChunks; ++i)
+        pageRefChunks[i].store(nullptr, std::memory_order_relaxed);
+
+    if (numShards == 0)
+        numShards = std::thread::hardware_concurrency();
+    if (numShards == 0)
+        numShards = 1;
+
+    for (std::size_t i = 0; i < numShards; ++i)
+        shards.emplace_back(
+            new Shard(
+                maxPageWidth, maxPageHeight,
+                rectsSpacing, pagePadding));
+}
+
+
+template<typename GeomT>
+ConcurrentPacker<GeomT>::~ConcurrentPacker()
+{
+    for (std::size_t i = 0; i < maxPageRefChunks; ++i)
+        delete[] pageRefChunks[i].load(std::memory_order_relaxed);
+}
+
+
+template<typename GeomT>
+typename ConcurrentPacker<GeomT>::InsertResult
+ConcurrentPacker<GeomT>::insert(GeomT width, GeomT height)
+{
+    const std::size_t homeIdx = (
+        detail::getThreadNumber() % shards.size());
+    std::size_t shardIdx = homeIdx;
+    std::unique_lock<std::mutex> lock(
+        shards[homeIdx]->mutex, std::try_to_lock);
+
+    if (!lock.owns_lock()) {
+        numContended.fetch_add(1, std::memory_order_relaxed);
+
+        for (std::size_t i = 1; i < shards.size(); ++i) {
+            shardIdx = (homeIdx + i) % shards.size();
+            lock = std::unique_lock<std::mutex>(
+                shards[shardIdx]->mutex, std::try_to_lock);
+            if (lock.owns_lock())
+                break;
+        }
+
+        if (lock.owns_lock())
+            numStolen.fetch_add(1, std::memory_order_relaxed);
+        else {
+            numWaits.fetch_add(1, std::memory_order_relaxed);
+            shardIdx = homeIdx;
+            lock = std::unique_lock<std::mutex>(shards[homeIdx]->mutex);
+        }
+    }
+
+    return insertIntoShard(shardIdx, width, height);
+}
+
+
+template<typename GeomT>
+typename ConcurrentPacker<GeomT>::InsertResult
+ConcurrentPacker<GeomT>::insertIntoShard(
+    std::size_t shardIdx, GeomT width, GeomT height)
+{
+    Shard& shard = *shards[shardIdx];
+    ++shard.numInserts;
+
+    InsertResult result = shard.packer.insert(width, height);
+    if (result.status != InsertStatus::ok)
+        return result;
+
+    // The shard adds pages one at a time, so a new page is always
+    // the next one.
+    while (result.pageIndex >= shard.pageIndices.size()) {
+        PageRef pageRef;
+        pageRef.shardIdx = shardIdx;
+        pageRef.pageIdx = shard.pageIndices.size();
+
+        const std::size_t pageIdx = numPages.fetch_add(1);
+        shard.pageIndices.push_back(pageIdx);
+        // Only this thread writes the ref; other threads can only
+        // learn the index through the shard lock or after insert()
+        // returns, which orders the write before their reads.
+        getPageRef(pageIdx) = pageRef;
+    }
+
+    result.pageIndex = shard.pageIndices[result.pageIndex];
+    return result;
+}
+
+
+template<typename GeomT>
+void ConcurrentPacker<GeomT>::getPageSize(
+    std::size_t pageIndex, GeomT& width, GeomT& height) const
+{
+    assert(pageIndex < numPages.load());
+    const PageRef& pageRef = getPageRef(pageIndex);
+
+    Shard& shard = *shards[pageRef.shardIdx];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.packer.getPageSize(pageRef.pageIdx, width, height);
+}
+
+
+template<typename GeomT>
+typename ConcurrentPacker<GeomT>::PageRef&
+ConcurrentPacker<GeomT>::getPageRef(std::size_t pageIndex)
+{
+    std::size_t chunkIdx, idx;
+    getPageRefLocation(pageIndex, chunkIdx, idx);
+
+    std::atomic<PageRef*>& chunkPtr = pageRefChunks[chunkIdx];
+    PageRef* chunk = chunkPtr.load(std::memory_order_acquire);
+    if (!chunk) {
+        // Shards may add their first pages in a chunk at the same
+        // time; the loser of the race frees its copy.
+        PageRef* newChunk = new PageRef[firstPageRefChunkSize << chunkIdx];
+        if (chunkPtr.compare_exchange_strong(
+                chunk, newChunk, std::memory_order_acq_rel))
+            chunk = newChunk;
+        else
+            delete[] newChunk;
+    }
+
+    return chunk[idx];
+}
+
+
+template<typename GeomT>
+const typename ConcurrentPacker<GeomT>::PageRef&
+ConcurrentPacker<GeomT>::getPageRef(std::size_t pageIndex) const
+{
+    std::size_t chunkIdx, idx;
+    getPageRefLocation(pageIndex, chunkIdx, idx);
+
+    const PageRef* chunk = pageRefChunks[chunkIdx].load(
+        std::memory_order_acquire);
+    assert(chunk);
+    return chunk[idx];
+}
+
+
+template<typename GeomT>
+void ConcurrentPacker<GeomT>::getPageRefLocation(
+    std::size_t pageIndex, std::size_t& chunkIdx, std::size_t& idx)
+{
+    // Chunk i starts at index (firstPageRefChunkSize << i) minus
+    // firstPageRefChunkSize.
+    const std::size_t biasedIdx = pageIndex + firstPageRefChunkSize;
+    chunkIdx = 0;
+    while ((biasedIdx >> chunkIdx) >= 2 * firstPageRefChunkSize)
+        ++chunkIdx;
+    idx = biasedIdx - (firstPageRefChunkSize << chunkIdx);
+}
+
+
+template<typename GeomT>
+typename ConcurrentPacker<GeomT>::ContentionStats
+ConcurrentPacker<GeomT>::getContentionStats() const
+{
+    ContentionStats stats;
+    stats.numInserts = 0;
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        std::lock_guard<std::mutex> lock(shards[i]->mutex);
+        stats.numInserts += shards[i]->numInserts;
+    }
+    stats.numContended = numContended.load(std::memory_order_relaxed);
+    stats.numStolen = numStolen.load(std::memory_order_relaxed);
+    stats.numWaits = numWaits.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+template<typename GeomT>
+void ConcurrentPacker<GeomT>::resetContentionStats()
+{
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        std::lock_guard<std::mutex> lock(shards[i]->mutex);
+        shards[i]->numInserts = 0;
+    }
+
+    numContended.store(0, std::memory_order_relaxed);
+    numStolen.store(0, std::memory_order_relaxed);
+    numWaits.store(0, std::memory_order_relaxed);
+}
+
+
+#endif  // DP_RECT_PACK_THREADS
+
+
 }  // namespace rect_pack
 }  // namespace dp
 
@@ -0,0 +1,221 @@
+#ifdef NDEBUG
+    #error "The tests should be compiled without NDEBUG."
+#endif
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "demo/atlasd_protocol.h"
+
+
+using namespace atlasd;
+
+
+static Request makeRequest(Opcode opcode)
+{
+    Request request;
+    request.opcode = opcode;
+
+    switch (opcode) {
+        case Opcode::open:
+            request.name = "atlas";
+            for (int i = 0; i < numGeometryValues; ++i)
+                request.geometry[i] = i * 3 - 7;
+            break;
+        case Opcode::alloc:
+            request.atlasId = 3;
+            request.sizes = {1, 2, 30, 40, -5, 0x7fffffff};
+            break;
+        case Opcode::pageSize:
+            request.atlasId = 0xffffffff;
+            request.pageIdx = 12;
+            break;
+        case Opcode::snapshot:
+            request.atlasId = 1;
+            request.snapshotName = "atlas.dpas";
+            break;
+    }
+
+    return request;
+}
+
+
+static bool decode(const std::vector<std::uint8_t>& data, Request& request)
+{
+    return decodeRequest(data.data(), data.size(), request);
+}
+
+
+static void testRequestRoundTrip()
+{
+    const Opcode opcodes[] = {
+        Opcode::open, Opcode::alloc, Opcode::pageSize, Opcode::snapshot,
+    };
+
+    for (const auto opcode : opcodes) {
+        const auto request = makeRequest(opcode);
+
+        std::vector<std::uint8_t> data;
+        encodeRequest(request, data);
+
+        Request decoded;
+        assert(decode(data, decoded));
+        assert(decoded.opcode == request.opcode);
+        assert(decoded.name == request.name);
+        for (int i = 0; i < numGeometryValues; ++i)
+            assert(decoded.geometry[i] == request.geometry[i]);
+        assert(decoded.atlasId == request.atlasId);
+        assert(decoded.sizes == request.sizes);
+        assert(decoded.pageIdx == request.pageIdx);
+        assert(decoded.snapshotName == request.snapshotName);
+
+        // Every truncated payload is rejected.
+        for (std::size_t size = 0; size < data.size(); ++size)
+            assert(!decodeRequest(data.data(), size, decoded));
+
+        // So is a trailing byte.
+        data.push_back(0);
+        assert(!decode(data, decoded));
+    }
+
+    // Alloc with no rects
+    {
+        auto request = makeRequest(Opcode::alloc);
+        request.sizes.clear();
+
+        std::vector<std::uint8_t> data;
+        encodeRequest(request, data);
+
+        Request decoded;
+        assert(decode(data, decoded));
+        assert(decoded.sizes.empty());
+    }
+}
+
+
+static void testInvalidRequest()
+{
+    Request request;
+
+    // Empty payload
+    assert(!decodeRequest(nullptr, 0, request));
+
+    // Unknown opcodes
+    {
+        const std::vector<std::uint8_t> data = {0};
+        assert(!decode(data, request));
+    }
+    {
+        const std::vector<std::uint8_t> data = {5, 0, 0, 0, 0};
+        assert(!decode(data, request));
+    }
+
+    // Alloc whose count doesn't match the number of rects
+    {
+        std::vector<std::uint8_t> data;
+        encodeRequest(makeRequest(Opcode::alloc), data);
+
+        // The count is at offset 5; the payload has 3 rects.
+        data[5] = 2;
+        assert(!decode(data, request));
+        data[5] = 4;
+        assert(!decode(data, request));
+    }
+
+    // Alloc with a huge count is rejected before allocating anything
+    // for it.
+    {
+        const std::vector<std::uint8_t> data = {
+            static_cast<std::uint8_t>(Opcode::alloc),
+            0, 0, 0, 0,
+            0xff, 0xff, 0xff, 0xff,
+            1, 0, 0, 0, 1, 0, 0, 0,
+        };
+        assert(!decode(data, request));
+    }
+}
+
+
+static void testSnapshotName()
+{
+    assert(isValidSnapshotName("atlas"));
+    assert(isValidSnapshotName("atlas.dpas"));
+    assert(isValidSnapshotName("a..b"));
+
+    assert(!isValidSnapshotName(""));
+    assert(!isValidSnapshotName("."));
+    assert(!isValidSnapshotName(".."));
+    assert(!isValidSnapshotName(".hidden"));
+    assert(!isValidSnapshotName("../atlas"));
+    assert(!isValidSnapshotName("dir/atlas"));
+    assert(!isValidSnapshotName("/tmp/atlas"));
+    assert(!isValidSnapshotName("dir\\atlas"));
+    assert(!isValidSnapshotName(std::string("a\0b", 3)));
+}
+
+
+static void testSnapshotRoundTrip()
+{
+    Snapshot snapshot;
+    snapshot.name = "atlas";
+    for (int i = 0; i < numGeometryValues; ++i)
+        snapshot.geometry[i] = 100 - i;
+    snapshot.sizes = {1, 2, 3, 4, 0x7fffffff, -1};
+
+    std::vector<std::uint8_t> data;
+    encodeSnapshot(snapshot, data);
+
+    Snapshot decoded;
+    assert(!decodeSnapshot(data.data(), data.size(), decoded));
+    assert(decoded.name == snapshot.name);
+    for (int i = 0; i < numGeometryValues; ++i)
+        assert(decoded.geometry[i] == snapshot.geometry[i]);
+    assert(decoded.sizes == snapshot.sizes);
+
+    for (std::size_t size = 0; size < data.size(); ++size)
+        assert(decodeSnapshot(data.data(), size, decoded));
+
+    // Trailing data
+    {
+        auto copy = data;
+        copy.push_back(0);
+        assert(decodeSnapshot(copy.data(), copy.size(), decoded));
+    }
+
+    // Bad magic
+    {
+        auto copy = data;
+        copy[0] = 'X';
+        assert(decodeSnapshot(copy.data(), copy.size(), decoded));
+    }
+
+    // Unsupported version
+    {
+        auto copy = data;
+        copy[4] = snapshotVersion + 1;
+        assert(decodeSnapshot(copy.data(), copy.size(), decoded));
+    }
+
+    // Empty atlas
+    {
+        snapshot.sizes.clear();
+        data.clear();
+        encodeSnapshot(snapshot, data);
+        assert(!decodeSnapshot(data.data(), data.size(), decoded));
+        assert(decoded.sizes.empty());
+    }
+}
+
+
+int main()
+{
+    testRequestRoundTrip();
+    testInvalidRequest();
+    testSnapshotName();
+    testSnapshotRoundTrip();
+
+    std::printf("All is OK\n");
+}
@@ -9,6 +9,8 @@
 
 #include <cassert>
 #include <cstdio>
+#include <iterator>
+#include <vector>
 
 #include "dp_rect_pack.h"
 
@@ -534,10 +536,697 @@ static void testInsert()
 }
 
 
+static void testInsertRepeated()
+{
+    // Errors
+    {
+        PT packer(10, 10);
+        std::vector<PT::InsertResult> results;
+
+        assert(
+            packer.insertRepeated(-1, 1, 2, std::back_inserter(results))
+            == InsertStatus::negativeSize);
+        assert(
+            packer.insertRepeated(1, 0, 2, std::back_inserter(results))
+            == InsertStatus::zeroSize);
+        assert(
+            packer.insertRepeated(11, 1, 2, std::back_inserter(results))
+            == InsertStatus::rectTooBig);
+        assert(results.empty());
+
+        assert(
+            packer.insertRepeated(1, 1, 0, std::back_inserter(results))
+            == InsertStatus::ok);
+        assert(results.empty());
+        assert(packer.getNumPages() == 1);
+    }
+
+    // Same layout as with insert()
+    {
+        const PT::Spacing spacing(1, 2);
+        const PT::Padding padding(1, 2, 3, 4);
+        PT packer(40, 50, spacing, padding);
+        PT refPacker(40, 50, spacing, padding);
+
+        unsigned seed = 1;
+        std::vector<PT::InsertResult> results;
+        for (int run = 0; run < 200; ++run) {
+            seed = seed * 1103515245 + 12345;
+            const GeomT w = 1 + (seed >> 16) % 12;
+            seed = seed * 1103515245 + 12345;
+            const GeomT h = 1 + (seed >> 16) % 12;
+            seed = seed * 1103515245 + 12345;
+            const std::size_t count = (seed >> 16) % 20;
+
+            results.clear();
+            assert(
+                packer.insertRepeated(
+                    w, h, count, std::back_inserter(results))
+                == InsertStatus::ok);
+            assert(results.size() == count);
+
+            for (std::size_t i = 0; i < count; ++i) {
+                const PT::InsertResult refResult = refPacker.insert(w, h);
+                assert(results[i].status == refResult.status);
+                assert(results[i].pos.x == refResult.pos.x);
+                assert(results[i].pos.y == refResult.pos.y);
+                assert(results[i].pageIndex == refResult.pageIndex);
+            }
+        }
+
+        assert(packer.getNumPages() > 1);
+        assert(packer.getNumPages() == refPacker.getNumPages());
+        for (std::size_t i = 0; i < packer.getNumPages(); ++i) {
+            GeomT w, h, refW, refH;
+            packer.getPageSize(i, w, h);
+            refPacker.getPageSize(i, refW, refH);
+            assert(w == refW);
+            assert(h == refH);
+        }
+    }
+}
+
+
+static void testTransaction()
+{
+    // Rollback
+    {
+        PT packer(20, 20, PT::Spacing(1), PT::Padding(2));
+        PT refPacker(20, 20, PT::Spacing(1), PT::Padding(2));
+
+        assert(packer.insert(10, 5).status == InsertStatus::ok);
+        assert(refPacker.insert(10, 5).status == InsertStatus::ok);
+
+        assert(!packer.isInTransaction());
+        packer.beginTransaction();
+        assert(packer.isInTransaction());
+        for (int i = 0; i < 10; ++i)
+            assert(packer.insert(6, 6).status == InsertStatus::ok);
+        assert(packer.getNumPages() > 1);
+        packer.rollbackTransaction();
+        assert(!packer.isInTransaction());
+
+        assert(packer.getNumPages() == 1);
+        GeomT w, h, refW, refH;
+        packer.getPageSize(0, w, h);
+        refPacker.getPageSize(0, refW, refH);
+        assert(w == refW);
+        assert(h == refH);
+
+        for (int i = 0; i < 10; ++i) {
+            const PT::InsertResult result = packer.insert(3, 4);
+            const PT::InsertResult refResult = refPacker.insert(3, 4);
+            assert(result.status == InsertStatus::ok);
+            assert(result.pos.x == refResult.pos.x);
+            assert(result.pos.y == refResult.pos.y);
+            assert(result.pageIndex == refResult.pageIndex);
+        }
+    }
+
+    // Commit
+    {
+        PT packer(20, 20);
+
+        packer.beginTransaction();
+        assert(packer.insert(20, 20).status == InsertStatus::ok);
+        assert(packer.insert(5, 5).pageIndex == 1);
+        packer.commitTransaction();
+        assert(!packer.isInTransaction());
+        assert(packer.getNumPages() == 2);
+    }
+
+    // canFit()
+    {
+        PT packer(10, 10);
+
+        assert(packer.canFit(10, 10));
+        assert(!packer.canFit(11, 1));
+        assert(!packer.canFit(0, 1));
+        assert(!packer.canFit(-1, 1));
+
+        assert(packer.insert(10, 5).status == InsertStatus::ok);
+        assert(packer.canFit(10, 5));
+        assert(!packer.canFit(10, 6));
+
+        GeomT w, h;
+        packer.getPageSize(0, w, h);
+        assert(w == 10);
+        assert(h == 5);
+        assert(packer.getNumPages() == 1);
+    }
+}
+
+
+static void testDirtyRegions()
+{
+    std::vector<PT::DirtyRegion> regions;
+    std::vector<std::size_t> resizedPages;
+
+    // Disabled by default
+    {
+        PT packer(10, 10);
+        assert(packer.insert(5, 5).status == InsertStatus::ok);
+
+        packer.takeDirtyRegions(regions, resizedPages);
+        assert(regions.empty());
+        assert(resizedPages.empty());
+    }
+
+    {
+        PT packer(10, 10);
+        packer.setMaxDirtyRegions(2);
+
+        // 5x5 at (0, 0), then 5x5 at (5, 0), then 10x5 at (0, 5).
+        // The last one is merged with the second.
+        assert(packer.insert(5, 5).status == InsertStatus::ok);
+        assert(packer.insert(5, 5).status == InsertStatus::ok);
+        assert(packer.insert(10, 5).status == InsertStatus::ok);
+        // New page
+        assert(packer.insert(10, 10).pageIndex == 1);
+
+        packer.takeDirtyRegions(regions, resizedPages);
+        assert(regions.size() == 3);
+
+        assert(regions[0].pageIndex == 0);
+        assert(regions[0].pos.x == 0);
+        assert(regions[0].pos.y == 0);
+        assert(regions[0].width == 5);
+        assert(regions[0].height == 5);
+
+        assert(regions[1].pageIndex == 0);
+        assert(regions[1].pos.x == 0);
+        assert(regions[1].pos.y == 0);
+        assert(regions[1].width == 10);
+        assert(regions[1].height == 10);
+
+        assert(regions[2].pageIndex == 1);
+        assert(regions[2].pos.x == 0);
+        assert(regions[2].pos.y == 0);
+        assert(regions[2].width == 10);
+        assert(regions[2].height == 10);
+
+        assert(resizedPages.size() == 2);
+        assert(resizedPages[0] == 0);
+        assert(resizedPages[1] == 1);
+
+        // Drained
+        packer.takeDirtyRegions(regions, resizedPages);
+        assert(regions.empty());
+        assert(resizedPages.empty());
+    }
+
+    // Insertion without resizing
+    {
+        PT packer(10, 10);
+        packer.setMaxDirtyRegions(4);
+
+        assert(packer.insert(10, 5).status == InsertStatus::ok);
+        assert(packer.insert(5, 5).status == InsertStatus::ok);
+        packer.takeDirtyRegions(regions, resizedPages);
+
+        const PT::InsertResult result = packer.insert(5, 5);
+        assert(result.status == InsertStatus::ok);
+        packer.takeDirtyRegions(regions, resizedPages);
+        assert(regions.size() == 1);
+        assert(regions[0].pos.x == result.pos.x);
+        assert(regions[0].pos.y == result.pos.y);
+        assert(resizedPages.empty());
+    }
+}
+
+
+static void testMemoryUsage()
+{
+    // Final pages and compact()
+    {
+        PT packer(10, 10);
+        for (int i = 0; i < 8; ++i)
+            assert(packer.insert(3, 3).status == InsertStatus::ok);
+        assert(packer.getNumPages() == 1);
+        assert(packer.getNumFreeNodes(0) > 0);
+
+        const MemoryUsage pageUsage = packer.getPageMemoryUsage(0);
+        assert(pageUsage.used > 0);
+        assert(pageUsage.used <= pageUsage.reserved);
+
+        const MemoryUsage usage = packer.getMemoryUsage();
+        assert(usage.used >= pageUsage.used);
+        assert(usage.reserved >= pageUsage.reserved);
+
+        packer.setPageFinal(0);
+        assert(packer.isPageFinal(0));
+        assert(!packer.canFit(1, 1));
+
+        // Would fit in page 0 if it wasn't final
+        const PT::InsertResult result = packer.insert(1, 1);
+        assert(result.status == InsertStatus::ok);
+        assert(result.pageIndex == 1);
+        assert(!packer.isPageFinal(1));
+
+        const MemoryUsage usageBeforeCompact = packer.getMemoryUsage();
+        packer.compact();
+        assert(packer.getNumFreeNodes(0) == 0);
+        assert(packer.getPageMemoryUsage(0).reserved == 0);
+        assert(
+            packer.getMemoryUsage().reserved
+            < usageBeforeCompact.reserved);
+
+        GeomT w, h;
+        packer.getPageSize(0, w, h);
+        assert(w == 9 && h == 9);
+    }
+
+    // compact() doesn't change further insertions
+    {
+        PT a(50, 50, PT::Spacing(1));
+        PT b(a);
+
+        for (int i = 0; i < 100; ++i) {
+            const int size = 10 - i / 10;
+            const PT::InsertResult ra = a.insert(size, size);
+
+            b.compact();
+            const MemoryUsage usage = b.getMemoryUsage();
+            assert(usage.used == usage.reserved);
+
+            const PT::InsertResult rb = b.insert(size, size);
+            assert(ra.status == rb.status);
+            assert(ra.pageIndex == rb.pageIndex);
+            assert(ra.pos.x == rb.pos.x);
+            assert(ra.pos.y == rb.pos.y);
+        }
+    }
+}
+
+
+struct ReorderResult {
+    std::size_t id;
+    PT::InsertResult result;
+};
+
+
+struct ReorderCallback {
+    std::vector<ReorderResult>* results;
+
+    void operator()(std::size_t id, const PT::InsertResult& result)
+    {
+        ReorderResult r;
+        r.id = id;
+        r.result = result;
+        results->push_back(r);
+    }
+};
+
+
+static void testReorderWindow()
+{
+    typedef ReorderWindow<GeomT, ReorderCallback> WT;
+
+    std::vector<ReorderResult> results;
+    ReorderCallback callback;
+    callback.results = &results;
+
+    // Rectangles are sorted within the window
+    {
+        PT packer(10, 10);
+        WT window(packer, callback, 3);
+
+        window.add(2, 2, 0);
+        window.add(5, 5, 1);
+        assert(window.getNumPending() == 2);
+        assert(results.empty());
+
+        // Full
+        window.add(3, 5, 2);
+        assert(window.getNumPending() == 0);
+        assert(results.size() == 3);
+        assert(results[0].id == 1);
+        assert(results[1].id == 2);
+        assert(results[2].id == 0);
+
+        PT sortedPacker(10, 10);
+        const GeomT sizes[3][2] = {{5, 5}, {3, 5}, {2, 2}};
+        for (std::size_t i = 0; i < 3; ++i) {
+            const PT::InsertResult expected = sortedPacker.insert(
+                sizes[i][0], sizes[i][1]);
+            assert(results[i].result.status == InsertStatus::ok);
+            assert(results[i].result.pos.x == expected.pos.x);
+            assert(results[i].result.pos.y == expected.pos.y);
+        }
+
+        // Errors are reported as well
+        results.clear();
+        window.add(11, 1, 3);
+        window.flush();
+        assert(results.size() == 1);
+        assert(results[0].id == 3);
+        assert(results[0].result.status == InsertStatus::rectTooBig);
+    }
+
+    // Delay
+    {
+        results.clear();
+        PT packer(10, 10);
+        WT window(packer, callback, 100);
+        window.setMaxDelay(10);
+
+        window.add(1, 1, 0, 100);
+        window.add(1, 1, 1, 105);
+        window.poll(109);
+        assert(results.empty());
+        window.poll(110);
+        assert(results.size() == 2);
+        assert(results[0].id == 0);
+        assert(results[1].id == 1);
+
+        // The delay is counted from the oldest rectangle
+        window.add(1, 1, 2, 200);
+        window.add(1, 1, 3, 210);
+        assert(results.size() == 4);
+    }
+}
+
+
+static void testPageSelection()
+{
+    // Page 0 is 7x7, page 1 is full.
+    PT base(10, 10);
+    assert(base.insert(7, 7).pageIndex == 0);
+    assert(base.insert(10, 10).pageIndex == 1);
+
+    {
+        PT packer(base);
+        assert(packer.canFit(3, 3));
+        assert(packer.insert(3, 3).pageIndex == 0);
+
+        const PageSelectionStats& stats = packer.getPageSelectionStats(
+            PageSelection::firstFit);
+        assert(stats.numRects == 3);
+        assert(stats.numPagesAdded == 1);
+    }
+
+    {
+        PT packer(base);
+        packer.resetPageSelectionStats();
+        packer.setPageSelection(PageSelection::lastPages);
+        assert(packer.getPageSelection() == PageSelection::lastPages);
+
+        assert(!packer.canFit(3, 3));
+        assert(packer.insert(3, 3).pageIndex == 2);
+
+        const PageSelectionStats& stats = packer.getPageSelectionStats(
+            PageSelection::lastPages);
+        assert(stats.numRects == 1);
+        assert(stats.numPagesChecked == 2);
+        assert(stats.numPagesAdded == 1);
+        assert(
+            packer.getPageSelectionStats(
+                PageSelection::firstFit).numRects == 0);
+
+        packer.setPageSelection(PageSelection::lastPages, 3);
+        assert(packer.insert(3, 3).pageIndex == 0);
+    }
+
+    {
+        PT packer(base);
+        assert(packer.insert(5, 5).pageIndex == 2);
+
+        // Growing page 0 to 10x7 wastes 12; growing page 2 to 8x5
+        // wastes 6.
+        packer.setPageSelection(PageSelection::bestFit);
+        assert(packer.insert(3, 3).pageIndex == 2);
+
+        const PageSelectionStats& stats = packer.getPageSelectionStats(
+            PageSelection::bestFit);
+        assert(stats.numRects == 1);
+        assert(stats.numPagesChecked == 3);
+        assert(stats.numPagesAdded == 0);
+    }
+}
+
+
+static void testMinRectSize()
+{
+    PT packer(256, 256, PT::Spacing(1));
+    PT prunedPacker(packer);
+    prunedPacker.setMinRectSize(4, 4);
+
+    std::size_t numFreeNodes = 0;
+    std::size_t numPrunedFreeNodes = 0;
+
+    unsigned state = 1;
+    for (GeomT h = 32; h >= 4; --h)
+        for (int i = 0; i < 16; ++i) {
+            state = state * 1103515245 + 12345;
+            const GeomT w = 4 + static_cast<GeomT>((state >> 16) % 29);
+
+            const PT::InsertResult result = packer.insert(w, h);
+            const PT::InsertResult prunedResult = prunedPacker.insert(w, h);
+            assert(result.status == InsertStatus::ok);
+            assert(prunedResult.status == InsertStatus::ok);
+            assert(result.pageIndex == prunedResult.pageIndex);
+            assert(result.pos.x == prunedResult.pos.x);
+            assert(result.pos.y == prunedResult.pos.y);
+        }
+
+    for (std::size_t i = 0; i < packer.getNumPages(); ++i) {
+        numFreeNodes += packer.getNumFreeNodes(i);
+        numPrunedFreeNodes += prunedPacker.getNumFreeNodes(i);
+    }
+
+    assert(numPrunedFreeNodes < numFreeNodes);
+
+    // Best fit should not choose a page for a free node that pruning
+    // removes on insertion. Rects smaller than the minimum size are
+    // allowed, so the rect goes to a new page.
+    {
+        PT bestFitPacker(19, 10);
+        bestFitPacker.insert(10, 10);
+        bestFitPacker.insert(5, 5);
+        bestFitPacker.insert(4, 4);
+
+        GeomT w, h;
+        bestFitPacker.getPageSize(0, w, h);
+
+        bestFitPacker.setMinRectSize(8, 8);
+        bestFitPacker.setPageSelection(PageSelection::bestFit);
+        assert(!bestFitPacker.canFit(5, 1));
+
+        const PT::InsertResult result = bestFitPacker.insert(5, 1);
+        assert(result.status == InsertStatus::ok);
+        assert(result.pageIndex == 1);
+        assert(result.pos.x == 0);
+        assert(result.pos.y == 0);
+
+        GeomT newW, newH;
+        bestFitPacker.getPageSize(0, newW, newH);
+        assert(newW == w);
+        assert(newH == h);
+    }
+}
+
+
+static void testInsertBudget()
+{
+    // Page 0 is full, page 1 is 7x7.
+    {
+        PT packer(10, 10);
+        assert(packer.insert(10, 10).pageIndex == 0);
+        assert(packer.insert(7, 7).pageIndex == 1);
+
+        PT budgetPacker(packer);
+        budgetPacker.setInsertBudget(0, 1);
+
+        const PT::InsertResult result = packer.insert(3, 3);
+        assert(result.pageIndex == 1);
+        assert(!result.budgetExceeded);
+
+        const PT::InsertResult budgetResult = budgetPacker.insert(3, 3);
+        assert(budgetResult.pageIndex == 2);
+        assert(budgetResult.budgetExceeded);
+    }
+
+    // Free nodes are 1x4 at (14, 5) and 5x1 at (10, 9).
+    {
+        PT packer(20, 10);
+        assert(packer.insert(10, 10).status == InsertStatus::ok);
+        assert(packer.insert(5, 5).status == InsertStatus::ok);
+        assert(packer.insert(4, 4).status == InsertStatus::ok);
+        assert(packer.getNumFreeNodes(0) == 2);
+
+        PT budgetPacker(packer);
+        budgetPacker.setInsertBudget(1, 0);
+
+        const PT::InsertResult result = packer.insert(5, 1);
+        assert(result.pos.x == 10);
+        assert(result.pos.y == 9);
+        assert(!result.budgetExceeded);
+
+        // The second node is not checked, so the page grows.
+        const PT::InsertResult budgetResult = budgetPacker.insert(5, 1);
+        assert(budgetResult.pageIndex == 0);
+        assert(budgetResult.pos.x == 15);
+        assert(budgetResult.pos.y == 0);
+        assert(budgetResult.budgetExceeded);
+    }
+}
+
+
+static void testFixedPageSize()
+{
+    PT packer(10, 10, PT::Spacing(0), PT::Padding(1));
+    assert(!packer.hasFixedPageSize());
+    packer.setFixedPageSize(true);
+    assert(packer.hasFixedPageSize());
+
+    GeomT w, h;
+    packer.getPageSize(0, w, h);
+    assert(w == 10);
+    assert(h == 10);
+
+    // Rects fill the page in rows.
+    PT::InsertResult result = packer.insert(3, 3);
+    assert(result.pageIndex == 0);
+    assert(result.pos.x == 1);
+    assert(result.pos.y == 1);
+
+    result = packer.insert(5, 3);
+    assert(result.pageIndex == 0);
+    assert(result.pos.x == 4);
+    assert(result.pos.y == 1);
+
+    result = packer.insert(2, 2);
+    assert(result.pageIndex == 0);
+    assert(result.pos.x == 1);
+    assert(result.pos.y == 4);
+
+    packer.getPageSize(0, w, h);
+    assert(w == 10);
+    assert(h == 10);
+
+    result = packer.insert(8, 8);
+    assert(result.pageIndex == 1);
+    assert(result.pos.x == 1);
+    assert(result.pos.y == 1);
+    assert(!packer.canFit(8, 8));
+
+    packer.beginTransaction();
+    assert(packer.insert(8, 8).pageIndex == 2);
+    packer.rollbackTransaction();
+    assert(packer.getNumPages() == 2);
+
+    packer.getPageSize(1, w, h);
+    assert(w == 10);
+    assert(h == 10);
+}
+
+
+static void testPageSizeFinder()
+{
+    typedef PageSizeFinder<GeomT> FT;
+
+    // Square
+    {
+        FT finder(100, 100);
+        for (int i = 0; i < 4; ++i)
+            finder.addRect(10, 10);
+
+        GeomT w, h;
+        assert(finder.find(w, h));
+        assert(w == 20);
+        assert(h == 20);
+    }
+
+    // Aspect ratio
+    {
+        FT finder(100, 100);
+        finder.setAspectRatio(2, 1);
+        finder.addRect(10, 10);
+        finder.addRect(10, 10);
+
+        GeomT w, h;
+        assert(finder.find(w, h));
+        assert(w == 20);
+        assert(h == 10);
+    }
+
+    // Power of two; wider pages are preferred
+    {
+        FT finder(100, 100);
+        finder.setPowerOfTwo(true);
+        for (int i = 0; i < 3; ++i)
+            finder.addRect(10, 10);
+
+        GeomT w, h;
+        assert(finder.find(w, h));
+        assert(w == 32);
+        assert(h == 16);
+    }
+
+    // Spacing and padding
+    {
+        const PT::Spacing spacing(1, 2);
+        const PT::Padding padding(1, 2, 3, 4);
+        FT finder(1000, 1000, spacing, padding);
+
+        const GeomT sizes[][2] = {
+            {30, 20}, {5, 17}, {12, 12}, {12, 12}, {40, 3}, {7, 7}
+        };
+        const std::size_t numSizes = sizeof(sizes) / sizeof(*sizes);
+        for (std::size_t i = 0; i < numSizes; ++i)
+            finder.addRect(sizes[i][0], sizes[i][1]);
+
+        GeomT w, h;
+        assert(finder.find(w, h));
+        assert(w == h);
+
+        // The sizes are already sorted as recommended.
+        PT packer(w, h, spacing, padding);
+        for (std::size_t i = 0; i < numSizes; ++i) {
+            const PT::InsertResult result = packer.insert(
+                sizes[i][0], sizes[i][1]);
+            assert(result.status == InsertStatus::ok);
+            assert(result.pageIndex == 0);
+        }
+    }
+
+    // Errors
+    {
+        GeomT w, h;
+
+        FT emptyFinder(100, 100);
+        assert(!emptyFinder.find(w, h));
+
+        FT tooBigFinder(100, 100);
+        tooBigFinder.addRect(101, 1);
+        assert(!tooBigFinder.find(w, h));
+
+        FT zeroSizeFinder(100, 100);
+        zeroSizeFinder.addRect(0, 1);
+        assert(!zeroSizeFinder.find(w, h));
+
+        FT tooManyFinder(100, 100);
+        for (int i = 0; i < 101; ++i)
+            tooManyFinder.addRect(10, 10);
+        assert(!tooManyFinder.find(w, h));
+    }
+}
+
+
 int main()
 {
     testConstructor();
     testInsert();
+    testInsertRepeated();
+    testTransaction();
+    testDirtyRegions();
+    testMemoryUsage();
+    testReorderWindow();
+    testPageSelection();
+    testMinRectSize();
+    testInsertBudget();
+    testFixedPageSize();
+    testPageSizeFinder();
 
     std::printf("All is OK\n");
 }
@@ -0,0 +1,719 @@
+// The stress test is also built in C++11 mode with
+// DP_RECT_PACK_THREADS to check the parallel page search.
+#if __cplusplus > 199711L && !defined(DP_RECT_PACK_THREADS)
+    #error "The tests should be compiled in C++98 mode."
+#endif
+
+#ifdef NDEBUG
+    #error "The tests should be compiled without NDEBUG."
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <vector>
+
+#ifdef DP_RECT_PACK_THREADS
+    #include <thread>
+#endif
+
+#include "dp_rect_pack.h"
+#include "reference_rect_pack.h"
+
+
+// Randomized stress test.
+//
+// Packs lots of random rectangles with random max page sizes,
+// spacing, and padding, checks the layouts for overlaps and bounds,
+// and compares them with the layouts of the reference implementation
+// (reference_rect_pack.h), which must be exactly the same. Some cases
+// use page selection policies other than first-fit, insertion
+// budgets, and fixed page size; their layouts are only checked for
+// overlaps and bounds.
+//
+// Usage: stress [NUM_RECTS [SEED]]
+//
+// On failure, the program prints the seed and the number of the
+// failed case and aborts.
+
+
+namespace rp = dp::rect_pack;
+namespace ref = dp::rect_pack_reference;
+
+
+static unsigned long seed = 1;
+static unsigned long caseNum;
+
+
+static void fail(const char* what)
+{
+    std::fprintf(
+        stderr, "Seed %lu, case %lu: %s\n", seed, caseNum, what);
+    std::abort();
+}
+
+
+// xorshift32
+class Random {
+public:
+    explicit Random(unsigned long seed)
+        : state(seed & 0xffffffff)
+    {
+        if (state == 0)
+            state = 1;
+    }
+
+    unsigned long next()
+    {
+        state ^= (state << 13) & 0xffffffff;
+        state ^= state >> 17;
+        state ^= (state << 5) & 0xffffffff;
+        return state;
+    }
+
+    // Returns a number in [min..max].
+    int range(int min, int max)
+    {
+        return min + static_cast<int>(next() % (max - min + 1));
+    }
+
+    bool chance(int percent)
+    {
+        return range(0, 99) < percent;
+    }
+private:
+    unsigned long state;
+};
+
+
+struct Config {
+    double maxW;
+    double maxH;
+    double spacingX;
+    double spacingY;
+    double padTop;
+    double padBottom;
+    double padLeft;
+    double padRight;
+};
+
+
+struct RectSize {
+    int w;
+    int h;
+};
+
+
+static bool compareRectSizes(const RectSize& a, const RectSize& b)
+{
+    if (a.h != b.h)
+        return a.h > b.h;
+    return a.w > b.w;
+}
+
+
+struct PlacedRect {
+    double x;
+    double y;
+    double w;
+    double h;
+};
+
+
+struct SweepEvent {
+    double x;
+    bool isEnd;
+    std::size_t rectIdx;
+
+    bool operator<(const SweepEvent& other) const
+    {
+        if (x != other.x)
+            return x < other.x;
+        // Rects are half-open, so the end of one rect and the start
+        // of another at the same x don't overlap.
+        return isEnd && !other.isEnd;
+    }
+};
+
+
+// Checks that the rects don't overlap, taking spacing into account.
+// A rect extended by spacing at its right and bottom edges must not
+// overlap other extended rects. O(n log n).
+static void checkOverlaps(
+    const std::vector<PlacedRect>& rects, double spacingX, double spacingY)
+{
+    std::vector<SweepEvent> events;
+    events.reserve(rects.size() * 2);
+    for (std::size_t i = 0; i < rects.size(); ++i) {
+        const PlacedRect& rect = rects[i];
+
+        SweepEvent event;
+        event.rectIdx = i;
+
+        event.x = rect.x;
+        event.isEnd = false;
+        events.push_back(event);
+
+        event.x = rect.x + rect.w + spacingX;
+        event.isEnd = true;
+        events.push_back(event);
+    }
+
+    std::sort(events.begin(), events.end());
+
+    // Vertical spans of the rects that intersect the sweep line. They
+    // never overlap, so they are unique and ordered by their tops.
+    typedef std::map<double, double> Spans;
+    Spans spans;
+
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        const SweepEvent& event = events[i];
+        const PlacedRect& rect = rects[event.rectIdx];
+        const double top = rect.y;
+        const double bottom = rect.y + rect.h + spacingY;
+
+        if (event.isEnd) {
+            spans.erase(top);
+            continue;
+        }
+
+        Spans::iterator next = spans.lower_bound(top);
+        if (next != spans.end() && next->first < bottom)
+            fail("Rects overlap or violate spacing");
+
+        if (next != spans.begin()) {
+            Spans::iterator prev = next;
+            --prev;
+            if (prev->second > top)
+                fail("Rects overlap or violate spacing");
+        }
+
+        spans.insert(next, Spans::value_type(top, bottom));
+    }
+}
+
+
+static void checkPage(
+    const Config& config,
+    double pageW, double pageH,
+    const std::vector<PlacedRect>& rects)
+{
+    if (pageW > std::max(config.maxW, 0.0)
+            || pageH > std::max(config.maxH, 0.0))
+        fail("Page is bigger than the max size");
+
+    if (rects.empty())
+        return;
+
+    const double padTop = std::max(config.padTop, 0.0);
+    const double padBottom = std::max(config.padBottom, 0.0);
+    const double padLeft = std::max(config.padLeft, 0.0);
+    const double padRight = std::max(config.padRight, 0.0);
+
+    for (std::size_t i = 0; i < rects.size(); ++i) {
+        const PlacedRect& rect = rects[i];
+        if (rect.x < padLeft
+                || rect.y < padTop
+                || rect.x + rect.w > pageW - padRight
+                || rect.y + rect.h > pageH - padBottom)
+            fail("Rect is out of the page bounds");
+    }
+
+    checkOverlaps(
+        rects,
+        std::max(config.spacingX, 0.0),
+        std::max(config.spacingY, 0.0));
+}
+
+
+template<typename GeomT>
+static GeomT getUnboundedSize()
+{
+    if (std::numeric_limits<GeomT>::has_infinity)
+        return std::numeric_limits<GeomT>::infinity();
+    return std::numeric_limits<GeomT>::max();
+}
+
+
+template<typename GeomT>
+static void runCase(
+    Random& random, const Config& config,
+    const std::vector<RectSize>& sizes)
+{
+    typedef rp::RectPacker<GeomT> Packer;
+    typedef ref::RectPacker<GeomT> RefPacker;
+
+    const GeomT maxW = config.maxW >= INT_MAX
+        ? getUnboundedSize<GeomT>() : static_cast<GeomT>(config.maxW);
+    const GeomT maxH = config.maxH >= INT_MAX
+        ? getUnboundedSize<GeomT>() : static_cast<GeomT>(config.maxH);
+
+    Packer packer(
+        maxW, maxH,
+        typename Packer::Spacing(
+            static_cast<GeomT>(config.spacingX),
+            static_cast<GeomT>(config.spacingY)),
+        typename Packer::Padding(
+            static_cast<GeomT>(config.padTop),
+            static_cast<GeomT>(config.padBottom),
+            static_cast<GeomT>(config.padLeft),
+            static_cast<GeomT>(config.padRight)));
+    #ifdef DP_RECT_PACK_THREADS
+    packer.setSearchThreads(1 + caseNum % 4);
+    #endif
+
+    const bool compareWithRef = caseNum % 5 < 3;
+    if (caseNum % 5 == 3)
+        packer.setPageSelection(
+            rp::PageSelection::lastPages, random.range(1, 4));
+    else if (caseNum % 5 == 4)
+        packer.setPageSelection(rp::PageSelection::bestFit);
+
+    // canFit() ignores the budget.
+    const bool hasBudget = !compareWithRef && random.chance(50);
+    if (hasBudget)
+        packer.setInsertBudget(random.range(0, 64), random.range(0, 4));
+
+    // Infinite pages can't have fixed size.
+    const bool fixedPageSize = (
+        !compareWithRef
+        && config.maxW < INT_MAX
+        && config.maxH < INT_MAX
+        && random.chance(50));
+    packer.setFixedPageSize(fixedPageSize);
+
+    RefPacker refPacker(
+        maxW, maxH,
+        typename RefPacker::Spacing(
+            static_cast<GeomT>(config.spacingX),
+            static_cast<GeomT>(config.spacingY)),
+        typename RefPacker::Padding(
+            static_cast<GeomT>(config.padTop),
+            static_cast<GeomT>(config.padBottom),
+            static_cast<GeomT>(config.padLeft),
+            static_cast<GeomT>(config.padRight)));
+
+    std::vector<std::vector<PlacedRect> > pageRects;
+    std::vector<typename Packer::InsertResult> results;
+
+    // The minimum size of the remaining rects is a valid hint for
+    // setMinRectSize(), so the layout must not change.
+    std::vector<RectSize> minSizes;
+    if (random.chance(50)) {
+        minSizes = sizes;
+        for (std::size_t i = minSizes.size(); i-- > 1;) {
+            minSizes[i - 1].w = std::min(minSizes[i - 1].w, minSizes[i].w);
+            minSizes[i - 1].h = std::min(minSizes[i - 1].h, minSizes[i].h);
+        }
+    }
+
+    for (std::size_t i = 0; i < sizes.size();) {
+        const RectSize& size = sizes[i];
+        std::size_t runEnd = i + 1;
+        while (runEnd < sizes.size()
+                && sizes[runEnd].w == size.w
+                && sizes[runEnd].h == size.h)
+            ++runEnd;
+
+        if (!minSizes.empty())
+            packer.setMinRectSize(minSizes[i].w, minSizes[i].h);
+
+        // Insert the run in a transaction and roll it back; the
+        // layout must be the same as if nothing happened.
+        if (random.chance(10)) {
+            const std::size_t numPages = packer.getNumPages();
+            const bool canFit = packer.canFit(size.w, size.h);
+
+            packer.beginTransaction();
+            results.clear();
+            packer.insertRepeated(
+                size.w, size.h, runEnd - i, std::back_inserter(results));
+            if (!hasBudget
+                    && canFit != (results.size() > 0
+                        && results[0].status == rp::InsertStatus::ok
+                        && results[0].pageIndex < numPages))
+                fail("canFit() differs from insert()");
+            packer.rollbackTransaction();
+
+            if (packer.getNumPages() != numPages)
+                fail("Rollback didn't remove new pages");
+        }
+
+        // Releasing memory must not change the layout either.
+        if (random.chance(2))
+            packer.compact();
+
+        results.clear();
+        if (random.chance(50)) {
+            const rp::InsertStatus::Type status = packer.insertRepeated(
+                size.w, size.h, runEnd - i, std::back_inserter(results));
+            if (status != rp::InsertStatus::ok) {
+                typename Packer::InsertResult result;
+                result.status = status;
+                results.resize(runEnd - i, result);
+            }
+        } else
+            for (std::size_t j = i; j < runEnd; ++j)
+                results.push_back(packer.insert(size.w, size.h));
+
+        if (results.size() != runEnd - i)
+            fail("insertRepeated() wrote wrong number of results");
+
+        for (std::size_t j = 0; j < results.size(); ++j) {
+            const typename Packer::InsertResult& result = results[j];
+            const typename RefPacker::InsertResult refResult = (
+                refPacker.insert(size.w, size.h));
+
+            if (static_cast<int>(result.status)
+                    != static_cast<int>(refResult.status))
+                fail("Status differs from the reference");
+
+            if (result.status != rp::InsertStatus::ok)
+                continue;
+
+            if (compareWithRef
+                    && (result.pageIndex != refResult.pageIndex
+                        || result.pos.x != refResult.pos.x
+                        || result.pos.y != refResult.pos.y))
+                fail("Position differs from the reference");
+
+            if (result.pageIndex >= pageRects.size())
+                pageRects.resize(result.pageIndex + 1);
+
+            PlacedRect rect;
+            rect.x = result.pos.x;
+            rect.y = result.pos.y;
+            rect.w = size.w;
+            rect.h = size.h;
+            pageRects[result.pageIndex].push_back(rect);
+        }
+
+        i = runEnd;
+    }
+
+    if (compareWithRef
+            && packer.getNumPages() != refPacker.getNumPages())
+        fail("Number of pages differs from the reference");
+
+    for (std::size_t i = 0; i < packer.getNumPages(); ++i) {
+        GeomT w, h;
+        packer.getPageSize(i, w, h);
+        if (compareWithRef) {
+            GeomT refW, refH;
+            refPacker.getPageSize(i, refW, refH);
+            if (w != refW || h != refH)
+                fail("Page size differs from the reference");
+        }
+
+        if (fixedPageSize && i > 0) {
+            GeomT firstW, firstH;
+            packer.getPageSize(0, firstW, firstH);
+            if (w != firstW || h != firstH)
+                fail("Fixed pages have different sizes");
+        }
+
+        checkPage(
+            config,
+            static_cast<double>(w), static_cast<double>(h),
+            i < pageRects.size() ? pageRects[i] : std::vector<PlacedRect>());
+    }
+}
+
+
+static double getRandomMaxSize(Random& random)
+{
+    const int kind = random.range(0, 9);
+    if (kind == 0)
+        return INT_MAX;  // Infinite single-page mode
+    else if (kind == 1)
+        return random.range(-2, 16);
+    else if (kind < 5)
+        return random.range(1, 256);
+    else
+        return random.range(64, 4096);
+}
+
+
+static double getRandomMargin(Random& random, int max)
+{
+    if (random.chance(30))
+        return 0;
+    else if (random.chance(5))
+        return -random.range(1, max);
+    return random.range(0, max);
+}
+
+
+static void generateCase(
+    Random& random, Config& config, std::vector<RectSize>& sizes)
+{
+    config.maxW = getRandomMaxSize(random);
+    config.maxH = random.chance(30) ? config.maxW : getRandomMaxSize(random);
+    config.spacingX = getRandomMargin(random, 4);
+    config.spacingY = random.chance(50)
+        ? config.spacingX : getRandomMargin(random, 4);
+    config.padTop = getRandomMargin(random, 8);
+    config.padBottom = getRandomMargin(random, 8);
+    config.padLeft = getRandomMargin(random, 8);
+    config.padRight = getRandomMargin(random, 8);
+
+    const std::size_t numRects = random.range(1, 5000);
+    const int maxRectW = random.range(1, 96);
+    const int maxRectH = random.chance(50)
+        ? maxRectW : random.range(1, 96);
+    // Few distinct sizes produce long runs of identical rects.
+    const bool fewSizes = random.chance(25);
+
+    sizes.clear();
+    while (sizes.size() < numRects) {
+        RectSize size;
+        if (random.chance(1)) {
+            size.w = random.range(-1, 1);
+            size.h = random.range(-1, 1);
+        } else if (fewSizes) {
+            size.w = 1 + maxRectW / random.range(1, 4);
+            size.h = 1 + maxRectH / random.range(1, 4);
+        } else {
+            size.w = random.range(1, maxRectW);
+            size.h = random.range(1, maxRectH);
+        }
+
+        const int count = random.chance(20) ? random.range(1, 64) : 1;
+        for (int i = 0; i < count && sizes.size() < numRects; ++i)
+            sizes.push_back(size);
+    }
+
+    if (random.chance(70))
+        std::sort(sizes.begin(), sizes.end(), compareRectSizes);
+}
+
+
+#ifdef DP_RECT_PACK_THREADS
+
+
+static int getMaxSize(double maxSize)
+{
+    return maxSize >= INT_MAX ? INT_MAX : static_cast<int>(maxSize);
+}
+
+
+// Packs several random cases as groups of GroupPacker and compares
+// the results with the reference. Returns the number of rects.
+static std::size_t runGroupCase(Random& random)
+{
+    std::vector<Config> configs(random.range(1, 12));
+    std::vector<std::vector<RectSize> > groupSizes(configs.size());
+
+    rp::GroupPacker<int> packer;
+    packer.setNumThreads(1 + caseNum % 4);
+
+    std::size_t numRects = 0;
+    for (std::size_t i = 0; i < configs.size(); ++i) {
+        const Config& config = configs[i];
+        const std::vector<RectSize>& sizes = groupSizes[i];
+        generateCase(random, configs[i], groupSizes[i]);
+
+        packer.addGroup(
+            getMaxSize(config.maxW), getMaxSize(config.maxH),
+            rp::GroupPacker<int>::Spacing(
+                config.spacingX, config.spacingY),
+            rp::GroupPacker<int>::Padding(
+                config.padTop, config.padBottom,
+                config.padLeft, config.padRight));
+        for (std::size_t j = 0; j < sizes.size(); ++j)
+            packer.addRect(sizes[j].w, sizes[j].h);
+
+        numRects += sizes.size();
+    }
+
+    packer.pack();
+
+    if (packer.getResults().size() != numRects)
+        fail("GroupPacker: wrong number of results");
+
+    for (std::size_t i = 0; i < configs.size(); ++i) {
+        const Config& config = configs[i];
+        const std::vector<RectSize>& sizes = groupSizes[i];
+
+        std::vector<std::size_t> order(sizes.size());
+        for (std::size_t j = 0; j < order.size(); ++j)
+            order[j] = j;
+        std::stable_sort(
+            order.begin(), order.end(),
+            [&](std::size_t a, std::size_t b)
+            {
+                return compareRectSizes(sizes[a], sizes[b]);
+            });
+
+        ref::RectPacker<int> refPacker(
+            getMaxSize(config.maxW), getMaxSize(config.maxH),
+            ref::RectPacker<int>::Spacing(
+                config.spacingX, config.spacingY),
+            ref::RectPacker<int>::Padding(
+                config.padTop, config.padBottom,
+                config.padLeft, config.padRight));
+
+        const std::size_t firstRect = packer.getGroupFirstRect(i);
+        for (std::size_t j = 0; j < order.size(); ++j) {
+            const RectSize& size = sizes[order[j]];
+            const ref::RectPacker<int>::InsertResult refResult = (
+                refPacker.insert(size.w, size.h));
+            const rp::GroupPacker<int>::InsertResult& result = (
+                packer.getResults()[firstRect + order[j]]);
+
+            if (static_cast<int>(result.status)
+                    != static_cast<int>(refResult.status))
+                fail("GroupPacker: status differs from the reference");
+
+            if (result.status == rp::InsertStatus::ok
+                    && (result.pageIndex != refResult.pageIndex
+                        || result.pos.x != refResult.pos.x
+                        || result.pos.y != refResult.pos.y))
+                fail("GroupPacker: position differs from the reference");
+        }
+
+        if (packer.getNumPages(i) != refPacker.getNumPages())
+            fail("GroupPacker: number of pages differs from the reference");
+
+        for (std::size_t j = 0; j < refPacker.getNumPages(); ++j) {
+            int w, h, refW, refH;
+            packer.getPageSize(i, j, w, h);
+            refPacker.getPageSize(j, refW, refH);
+            if (w != refW || h != refH)
+                fail("GroupPacker: page size differs from the reference");
+        }
+    }
+
+    return numRects;
+}
+
+
+// Packs a random case with ConcurrentPacker from several threads.
+// The layout depends on timing, so it's only checked for overlaps
+// and bounds. Returns the number of rects.
+static std::size_t runConcurrentCase(Random& random)
+{
+    Config config;
+    std::vector<RectSize> sizes;
+    generateCase(random, config, sizes);
+
+    rp::ConcurrentPacker<int> packer(
+        getMaxSize(config.maxW), getMaxSize(config.maxH),
+        rp::ConcurrentPacker<int>::Spacing(
+            config.spacingX, config.spacingY),
+        rp::ConcurrentPacker<int>::Padding(
+            config.padTop, config.padBottom,
+            config.padLeft, config.padRight),
+        random.range(1, 4));
+
+    // Each thread takes every numThreads-th rect, so the rects of
+    // a thread keep the sorted order, if any.
+    const std::size_t numThreads = random.range(1, 4);
+    std::vector<rp::ConcurrentPacker<int>::InsertResult> results(
+        sizes.size());
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < numThreads; ++t)
+        threads.emplace_back([&, t]{
+            for (std::size_t i = t; i < sizes.size(); i += numThreads)
+                results[i] = packer.insert(sizes[i].w, sizes[i].h);
+        });
+    for (std::size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    const rp::ConcurrentPacker<int>::ContentionStats stats = (
+        packer.getContentionStats());
+    if (stats.numInserts != sizes.size())
+        fail("ConcurrentPacker: wrong number of inserts in stats");
+    if (stats.numStolen + stats.numWaits != stats.numContended)
+        fail("ConcurrentPacker: inconsistent contention stats");
+
+    // The status doesn't depend on the layout.
+    ref::RectPacker<int> refPacker(
+        getMaxSize(config.maxW), getMaxSize(config.maxH),
+        ref::RectPacker<int>::Spacing(config.spacingX, config.spacingY),
+        ref::RectPacker<int>::Padding(
+            config.padTop, config.padBottom,
+            config.padLeft, config.padRight));
+
+    std::vector<std::vector<PlacedRect> > pageRects(packer.getNumPages());
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        const rp::ConcurrentPacker<int>::InsertResult& result = results[i];
+        if (static_cast<int>(result.status)
+                != static_cast<int>(
+                    refPacker.insert(sizes[i].w, sizes[i].h).status))
+            fail("ConcurrentPacker: status differs from the reference");
+
+        if (result.status != rp::InsertStatus::ok)
+            continue;
+
+        if (result.pageIndex >= pageRects.size())
+            fail("ConcurrentPacker: page index is out of range");
+
+        PlacedRect rect;
+        rect.x = result.pos.x;
+        rect.y = result.pos.y;
+        rect.w = sizes[i].w;
+        rect.h = sizes[i].h;
+        pageRects[result.pageIndex].push_back(rect);
+    }
+
+    for (std::size_t i = 0; i < pageRects.size(); ++i) {
+        if (pageRects[i].empty())
+            fail("ConcurrentPacker: page has no rects");
+
+        int w, h;
+        packer.getPageSize(i, w, h);
+        checkPage(config, w, h, pageRects[i]);
+    }
+
+    return sizes.size();
+}
+
+
+#endif  // DP_RECT_PACK_THREADS
+
+
+int main(int argc, char* argv[])
+{
+    unsigned long numRects = 1000000;
+    if (argc > 1)
+        numRects = std::strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        seed = std::strtoul(argv[2], NULL, 10);
+
+    Random random(seed);
+    Config config;
+    std::vector<RectSize> sizes;
+
+    unsigned long totalRects = 0;
+    for (caseNum = 0; totalRects < numRects; ++caseNum) {
+        generateCase(random, config, sizes);
+        if (caseNum % 2 == 0)
+            runCase<int>(random, config, sizes);
+        else
+            runCase<double>(random, config, sizes);
+
+        totalRects += sizes.size();
+
+        #ifdef DP_RECT_PACK_THREADS
+        if (caseNum % 8 == 0) {
+            // Use a separate generator to keep the other cases the
+            // same as in the C++98 build.
+            Random groupRandom(seed + caseNum);
+            totalRects += runGroupCase(groupRandom);
+        }
+
+        if (caseNum % 8 == 4) {
+            Random concurrentRandom(seed + caseNum);
+            totalRects += runConcurrentCase(concurrentRandom);
+        }
+        #endif
+    }
+
+    std::printf(
+        "All is OK (%lu rects in %lu cases)\n", totalRects, caseNum);
+}